@@ -0,0 +1,342 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstring>
+
+#include <framework/Pipeline.hpp>
+#include <framework/StageDataPool.hpp>
+
+
+/// Throughput and latency benchmark for Pipeline.
+///
+/// Runs a pipeline for every combination of stage count, payload size, batch size and buffer type,
+/// injecting items from the main thread, and writes one result per line as CSV (default) or JSON.
+///
+///     pipeline_bench --stages 1,2,4 --payload 64,4096 --batch 1,32 --buffer queue,ring --items 200000 --format csv
+///
+/// Latencies are from Pipeline::injectData() until the last stage takes the item, in nanoseconds.
+
+
+using namespace framework;
+using namespace std::chrono_literals;
+
+using std::vector;
+using std::string;
+
+
+struct BenchData : public StageData
+{
+    BenchData(const size_t payloadSize) : payload(payloadSize, 1U)
+    {
+
+    }
+
+    vector<uint8_t> payload;
+    uint64_t checksum = 0;
+};
+
+
+struct BenchConfig
+{
+    size_t stages;
+    size_t payload;
+    size_t batch;
+    PipelineStage::BufferType buffer;
+    size_t items;
+};
+
+
+/// Reads every cache line of the payload, so the payload size affects the cost of each stage.
+static void touch(BenchData& data)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < data.payload.size(); i += 64U)
+        sum += data.payload[i];
+
+    data.checksum += sum;
+}
+
+
+class RelayStage : public PipelineStage
+{
+public:
+    RelayStage(const BenchConfig& config) : PipelineStage("relay", BufferConfig{ config.buffer, DefaultBufferCapacity }), m_batchSize(config.batch)
+    {
+
+    }
+
+    virtual void run() override
+    {
+        vector<shared_ptr<BenchData>> batch;
+
+        while (!shouldStop())
+        {
+            if (m_batchSize > 1U)
+            {
+                batch.clear();
+
+                if (nextBatch<BenchData>(batch, m_batchSize, 10ms))
+                {
+                    for (auto& data : batch)
+                        touch(*data);
+
+                    dataComplete(batch);
+                }
+            }
+            else if (auto data = nextData<BenchData>(10ms); data)
+            {
+                touch(*data);
+                dataComplete(std::move(data));
+            }
+        }
+    }
+
+private:
+    const size_t m_batchSize;
+};
+
+
+class SinkStage : public PipelineStage
+{
+public:
+    SinkStage(const BenchConfig& config, std::atomic_size_t& received) : PipelineStage("sink", BufferConfig{ config.buffer, DefaultBufferCapacity }),
+                                                                         m_batchSize(config.batch), m_received(received)
+    {
+
+    }
+
+    virtual void run() override
+    {
+        vector<shared_ptr<BenchData>> batch;
+
+        while (!shouldStop())
+        {
+            batch.clear();
+
+            if (nextBatch<BenchData>(batch, m_batchSize, 10ms))
+            {
+                for (auto& data : batch)
+                    touch(*data);
+
+                m_received.fetch_add(batch.size(), std::memory_order_release);
+            }
+        }
+    }
+
+private:
+    const size_t m_batchSize;
+    std::atomic_size_t& m_received;
+};
+
+
+struct BenchResult
+{
+    size_t items;
+    double seconds;
+    LatencySnapshot latency;
+};
+
+
+static BenchResult runBench(const BenchConfig& config)
+{
+    std::atomic_size_t received(0);
+
+    // pooled, so the benchmark measures the pipeline rather than the allocator
+    const size_t poolSize = (config.stages + 1U) * PipelineStage::DefaultBufferCapacity;
+    StageDataPool<BenchData> pool(poolSize, poolSize, [&config] { return std::make_unique<BenchData>(config.payload); });
+
+    Pipeline pipeline("bench");
+
+    for (size_t i = 1; i < config.stages; ++i)
+        pipeline.addStage(std::make_shared<RelayStage>(config));
+
+    pipeline.addStage(std::make_shared<SinkStage>(config, received));
+
+    BenchResult result{ 0, 0.0, LatencySnapshot() };
+
+    if (!pipeline.initialise())
+        return result;
+
+    pipeline.start();
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < config.items; ++i)
+    {
+        pipeline.injectData(pool.acquire());
+    }
+
+    const auto deadline = start + 60s;
+
+    while (received.load(std::memory_order_acquire) < config.items && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::yield();
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+
+    result.items = received.load();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.latency = pipeline.pipelineLatency();
+
+    pipeline.stop();
+
+    return result;
+}
+
+
+static vector<size_t> parseSizes(const string& arg)
+{
+    vector<size_t> sizes;
+    std::stringstream ss(arg);
+
+    for (string item; std::getline(ss, item, ',');)
+    {
+        if (!item.empty())
+            sizes.push_back(std::stoul(item));
+    }
+
+    return sizes;
+}
+
+
+static vector<PipelineStage::BufferType> parseBuffers(const string& arg)
+{
+    vector<PipelineStage::BufferType> buffers;
+    std::stringstream ss(arg);
+
+    for (string item; std::getline(ss, item, ',');)
+    {
+        if (item == "queue")
+            buffers.push_back(PipelineStage::BufferType::Queue);
+        else if (item == "ring")
+            buffers.push_back(PipelineStage::BufferType::RingBuffer);
+        else
+            throw std::invalid_argument("unknown buffer type: " + item);
+    }
+
+    return buffers;
+}
+
+
+static void writeResult(std::ostream& out, const string& format, const BenchConfig& config, const BenchResult& result)
+{
+    const char* buffer = config.buffer == PipelineStage::BufferType::Queue ? "queue" : "ring";
+    const double itemsPerSec = result.seconds > 0.0 ? static_cast<double>(result.items) / result.seconds : 0.0;
+    const auto& latency = result.latency;
+
+    if (format == "json")
+    {
+        out << "{\"stages\":" << config.stages << ",\"payload\":" << config.payload << ",\"batch\":" << config.batch
+            << ",\"buffer\":\"" << buffer << "\",\"items\":" << result.items << ",\"seconds\":" << result.seconds
+            << ",\"items_per_sec\":" << static_cast<uint64_t>(itemsPerSec)
+            << ",\"p50_ns\":" << latency.p50().count() << ",\"p99_ns\":" << latency.p99().count()
+            << ",\"p999_ns\":" << latency.p999().count() << ",\"max_ns\":" << latency.max().count() << "}\n";
+    }
+    else
+    {
+        out << config.stages << "," << config.payload << "," << config.batch << "," << buffer << "," << result.items << ","
+            << result.seconds << "," << static_cast<uint64_t>(itemsPerSec) << "," << latency.p50().count() << ","
+            << latency.p99().count() << "," << latency.p999().count() << "," << latency.max().count() << "\n";
+    }
+
+    out.flush();
+}
+
+
+static void usage()
+{
+    std::cerr << "pipeline_bench [--stages 1,2,4] [--payload 64,4096] [--batch 1,32] [--buffer queue,ring]\n"
+                 "               [--items 200000] [--format csv|json] [--out file]\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    vector<size_t> stageCounts{ 1, 2, 4 };
+    vector<size_t> payloads{ 64, 4096 };
+    vector<size_t> batches{ 1, 32 };
+    vector<PipelineStage::BufferType> buffers{ PipelineStage::BufferType::Queue, PipelineStage::BufferType::RingBuffer };
+    size_t items = 200000;
+    string format = "csv";
+    string outFile;
+
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const string arg(argv[i]);
+
+            if (i + 1 >= argc)
+            {
+                usage();
+                return 1;
+            }
+
+            const string value(argv[++i]);
+
+            if (arg == "--stages")
+                stageCounts = parseSizes(value);
+            else if (arg == "--payload")
+                payloads = parseSizes(value);
+            else if (arg == "--batch")
+                batches = parseSizes(value);
+            else if (arg == "--buffer")
+                buffers = parseBuffers(value);
+            else if (arg == "--items")
+                items = std::stoul(value);
+            else if (arg == "--format")
+                format = value;
+            else if (arg == "--out")
+                outFile = value;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << ex.what() << "\n";
+        usage();
+        return 1;
+    }
+
+    std::ofstream file;
+
+    if (!outFile.empty())
+        file.open(outFile);
+
+    std::ostream out(outFile.empty() ? std::cout.rdbuf() : file.rdbuf());
+
+    // logg() writes to std::cout, keep it out of the results
+    std::cout.rdbuf(nullptr);
+
+    if (format != "json")
+        out << "stages,payload,batch,buffer,items,seconds,items_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n";
+
+    for (const auto stages : stageCounts)
+    {
+        for (const auto payload : payloads)
+        {
+            for (const auto batch : batches)
+            {
+                for (const auto buffer : buffers)
+                {
+                    const BenchConfig config{ std::max<size_t>(stages, 1U), payload, std::max<size_t>(batch, 1U), buffer, items };
+
+                    writeResult(out, format, config, runBench(config));
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include <asio.hpp>
+
+#include "PayloadBuffer.hpp"
+
+
+namespace framework
+{
+    /// asio buffer views of payloads, so sockets read into and write from payload blocks without copying.
+    /// The payload must be kept alive until the operation completes, i.e. captured by the handler.
+    ///
+    ///    auto payload = std::make_shared<PayloadChain>(pool.allocateChain(64 * 1024));
+    ///    socket.async_read_some(mutableBuffers(*payload), [payload](asio::error_code error, size_t n)
+    ///    {
+    ///        payload->truncate(n);
+    ///        ...
+    ///    });
+    ///
+    ///    asio::async_write(socket, constBuffers(*payload), [payload](asio::error_code error, size_t n) { ... });
+
+    inline asio::const_buffer constBuffer(const PayloadSlice& slice)
+    {
+        return asio::const_buffer(slice.data(), slice.size());
+    }
+
+
+    inline asio::mutable_buffer mutableBuffer(const PayloadSlice& slice)
+    {
+        return asio::mutable_buffer(slice.data(), slice.size());
+    }
+
+
+    /// A gather list for a write.
+    inline std::vector<asio::const_buffer> constBuffers(const PayloadChain& chain)
+    {
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(chain.sliceCount());
+
+        for (const auto& slice : chain)
+            buffers.push_back(constBuffer(slice));
+
+        return buffers;
+    }
+
+
+    /// A scatter list for a read.
+    inline std::vector<asio::mutable_buffer> mutableBuffers(const PayloadChain& chain)
+    {
+        std::vector<asio::mutable_buffer> buffers;
+        buffers.reserve(chain.sliceCount());
+
+        for (const auto& slice : chain)
+            buffers.push_back(mutableBuffer(slice));
+
+        return buffers;
+    }
+}
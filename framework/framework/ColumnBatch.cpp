@@ -0,0 +1,122 @@
+#include "ColumnBatch.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <string>
+
+
+namespace framework
+{
+    /// Moves the elements whose mask is set to the front, in order. Branch free: each element is written,
+    /// but the output only advances past the kept ones. Copied as bytes, the column's type isn't known here.
+    template<size_t Size>
+    static size_t compact(char* column, const uint8_t* mask, const size_t n)
+    {
+        size_t kept = 0;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            std::memmove(column + kept * Size, column + i * Size, Size);
+            kept += mask[i] != 0;
+        }
+
+        return kept;
+    }
+
+
+    static size_t compact(char* column, const size_t elementSize, const uint8_t* mask, const size_t n)
+    {
+        size_t kept = 0;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (mask[i])
+            {
+                if (kept != i)
+                    std::memcpy(column + kept * elementSize, column + i * elementSize, elementSize);
+
+                ++kept;
+            }
+        }
+
+        return kept;
+    }
+
+
+    ColumnBatch::ColumnBatch(const size_t capacity) : m_capacity(capacity), m_size(0)
+    {
+
+    }
+
+
+    size_t ColumnBatch::addColumn(const size_t elementSize, const std::type_info& type)
+    {
+        // at least one byte, so every column has its own address
+        const size_t bytes = std::max<size_t>(m_capacity * elementSize, 1U);
+
+        m_columns.push_back(ColumnStorage{ std::unique_ptr<char, AlignedDelete>(static_cast<char*>(::operator new(bytes, std::align_val_t{ Alignment }))), elementSize, type });
+
+        return m_columns.size() - 1U;
+    }
+
+
+    void* ColumnBatch::checkedColumn(const size_t index, const std::type_info& type)
+    {
+        if (index >= m_columns.size() || m_columns[index].type != std::type_index(type))
+            throw std::runtime_error("ColumnBatch: column " + std::to_string(index) + " doesn't exist or isn't a " + type.name());
+
+        return m_columns[index].data.get();
+    }
+
+
+    void ColumnBatch::resize(const size_t rows)
+    {
+        if (rows > m_capacity)
+            throw std::runtime_error("ColumnBatch: " + std::to_string(rows) + " rows is more than the capacity " + std::to_string(m_capacity));
+
+        m_size = rows;
+    }
+
+
+    size_t ColumnBatch::select(const uint8_t* mask)
+    {
+        size_t kept = m_size;
+
+        for (auto& column : m_columns)
+        {
+            char* data = column.data.get();
+
+            switch (column.elementSize)
+            {
+            case 1: kept = compact<1>(data, mask, m_size); break;
+            case 2: kept = compact<2>(data, mask, m_size); break;
+            case 4: kept = compact<4>(data, mask, m_size); break;
+            case 8: kept = compact<8>(data, mask, m_size); break;
+            default: kept = compact(data, column.elementSize, mask, m_size); break;
+            }
+        }
+
+        if (m_columns.empty())
+        {
+            kept = 0;
+
+            for (size_t i = 0; i < m_size; ++i)
+                kept += mask[i] != 0;
+        }
+
+        m_size = kept;
+
+        return kept;
+    }
+
+
+    size_t ColumnBatch::byteSize() const
+    {
+        size_t bytes = 0;
+
+        for (auto& column : m_columns)
+            bytes += m_capacity * column.elementSize;
+
+        return bytes;
+    }
+}
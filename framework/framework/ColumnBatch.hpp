@@ -0,0 +1,221 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <typeindex>
+#include <type_traits>
+#include <stdexcept>
+#include <cstdint>
+
+#include "PipelineStage.hpp"
+
+
+namespace framework
+{
+    /// A batch of records as structure of arrays: one aligned column per field, each with room for capacity rows.
+    /// Passing thousands of records as one StageData costs one queue hop instead of one per record, and a stage
+    /// works through a column at SIMD width rather than chasing a pointer per record. See the columns:: kernels.
+    ///
+    ///     auto batch = std::make_shared<ColumnBatch>(4096);
+    ///     const size_t price = batch->addColumn<double>();
+    ///     const size_t volume = batch->addColumn<int32_t>();
+    ///     batch->resize(rows);
+    ///     fill(batch->column<double>(price), ...);
+    ///
+    /// Columns are added before rows, and must be trivially copyable types.
+    class ColumnBatch : public StageData
+    {
+    public:
+        /// Of each column, so aligned SIMD loads work from the start of a column.
+        static const size_t Alignment = 64U;
+
+
+        explicit ColumnBatch(const size_t capacity);
+
+        /// Returns the new column's index.
+        template<class T>
+        size_t addColumn()
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "ColumnBatch columns must be trivially copyable");
+
+            return addColumn(sizeof(T), typeid(T));
+        }
+
+        /// Throws std::runtime_error if the column isn't a T.
+        template<class T>
+        T* column(const size_t index)
+        {
+            return static_cast<T*>(checkedColumn(index, typeid(T)));
+        }
+
+        template<class T>
+        const T* column(const size_t index) const
+        {
+            return static_cast<const T*>(const_cast<ColumnBatch*>(this)->checkedColumn(index, typeid(T)));
+        }
+
+        size_t capacity() const { return m_capacity; }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        size_t columnCount() const { return m_columns.size(); }
+
+        /// Sets the number of rows, i.e. after filling the columns. Throws std::runtime_error if more than the capacity.
+        void resize(const size_t rows);
+        void clear() { m_size = 0; }
+
+        /// Keeps the rows whose mask is non zero, in every column, in order. Returns the number of rows kept.
+        size_t select(const uint8_t* mask);
+
+        virtual size_t byteSize() const override;
+
+    private:
+        struct AlignedDelete
+        {
+            void operator()(char* p) const { ::operator delete(p, std::align_val_t{ Alignment }); }
+        };
+
+
+        struct ColumnStorage
+        {
+            std::unique_ptr<char, AlignedDelete> data;
+            size_t elementSize;
+            std::type_index type;
+        };
+
+
+        size_t addColumn(const size_t elementSize, const std::type_info& type);
+        void* checkedColumn(const size_t index, const std::type_info& type);
+
+    private:
+        const size_t m_capacity;
+        size_t m_size;
+        std::vector<ColumnStorage> m_columns;
+    };
+
+
+    /// Kernels over columns, written as simple loops over contiguous arrays, without branches or calls in the loop
+    /// body, so the compiler vectorizes them for the target's SIMD width (build with optimisation, and i.e. -mavx2
+    /// or /arch:AVX2 for wider than SSE2). Reductions keep a cache line of independent accumulators, so floating point
+    /// sums vectorize without -ffast-math.
+    namespace columns
+    {
+        enum class Compare { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+
+        /// out[i] = f(in[i]). out may be in.
+        template<class In, class Out, class F>
+        void transform(const In* in, Out* out, const size_t n, F f)
+        {
+            for (size_t i = 0; i < n; ++i)
+                out[i] = f(in[i]);
+        }
+
+
+        /// out[i] = f(a[i], b[i]). out may be a or b.
+        template<class A, class B, class Out, class F>
+        void transform(const A* a, const B* b, Out* out, const size_t n, F f)
+        {
+            for (size_t i = 0; i < n; ++i)
+                out[i] = f(a[i], b[i]);
+        }
+
+
+        /// mask[i] = 1 where column[i] compares true with value, otherwise 0. For ColumnBatch::select().
+        template<class T>
+        void compare(const T* column, const T value, const Compare op, uint8_t* mask, const size_t n)
+        {
+            // one loop per operator, so the comparison isn't chosen per element
+            switch (op)
+            {
+            case Compare::Less:         for (size_t i = 0; i < n; ++i) mask[i] = static_cast<uint8_t>(column[i] < value); break;
+            case Compare::LessEqual:    for (size_t i = 0; i < n; ++i) mask[i] = static_cast<uint8_t>(column[i] <= value); break;
+            case Compare::Greater:      for (size_t i = 0; i < n; ++i) mask[i] = static_cast<uint8_t>(column[i] > value); break;
+            case Compare::GreaterEqual: for (size_t i = 0; i < n; ++i) mask[i] = static_cast<uint8_t>(column[i] >= value); break;
+            case Compare::Equal:        for (size_t i = 0; i < n; ++i) mask[i] = static_cast<uint8_t>(column[i] == value); break;
+            case Compare::NotEqual:     for (size_t i = 0; i < n; ++i) mask[i] = static_cast<uint8_t>(column[i] != value); break;
+            }
+        }
+
+
+        /// mask[i] &= other[i], to combine conditions.
+        inline void maskAnd(uint8_t* mask, const uint8_t* other, const size_t n)
+        {
+            for (size_t i = 0; i < n; ++i)
+                mask[i] &= other[i];
+        }
+
+
+        /// Keeps the rows of batch where column compares true with value.
+        template<class T>
+        size_t filter(ColumnBatch& batch, const size_t column, const T value, const Compare op)
+        {
+            thread_local std::vector<uint8_t> mask;
+            mask.resize(batch.size());
+
+            compare(batch.column<T>(column), value, op, mask.data(), batch.size());
+
+            return batch.select(mask.data());
+        }
+
+
+        /// Folds column with op, an associative and commutative operation, from identity.
+        template<class T, class Op>
+        T reduce(const T* column, const size_t n, const T identity, Op op)
+        {
+            constexpr size_t Lanes = ColumnBatch::Alignment / sizeof(T) > 0 ? ColumnBatch::Alignment / sizeof(T) : 1U;
+
+            T lanes[Lanes];
+
+            for (size_t lane = 0; lane < Lanes; ++lane)
+                lanes[lane] = identity;
+
+            const size_t whole = n - n % Lanes;
+            size_t i = 0;
+
+            for ( ; i < whole; i += Lanes)
+            {
+                for (size_t lane = 0; lane < Lanes; ++lane)
+                    lanes[lane] = op(lanes[lane], column[i + lane]);
+            }
+
+            T result = identity;
+
+            for (size_t lane = 0; lane < Lanes; ++lane)
+                result = op(result, lanes[lane]);
+
+            for ( ; i < n; ++i)
+                result = op(result, column[i]);
+
+            return result;
+        }
+
+
+        template<class T>
+        T sum(const T* column, const size_t n)
+        {
+            return reduce(column, n, T{}, [](const T a, const T b) { return a + b; });
+        }
+
+
+        /// Throws std::runtime_error if n is 0.
+        template<class T>
+        T minimum(const T* column, const size_t n)
+        {
+            if (n == 0)
+                throw std::runtime_error("columns::minimum() of no rows");
+
+            return reduce(column, n, column[0], [](const T a, const T b) { return b < a ? b : a; });
+        }
+
+
+        /// Throws std::runtime_error if n is 0.
+        template<class T>
+        T maximum(const T* column, const size_t n)
+        {
+            if (n == 0)
+                throw std::runtime_error("columns::maximum() of no rows");
+
+            return reduce(column, n, column[0], [](const T a, const T b) { return a < b ? b : a; });
+        }
+    }
+}
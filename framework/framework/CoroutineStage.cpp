@@ -0,0 +1,63 @@
+#include "CoroutineStage.hpp"
+
+#ifdef FRAMEWORK_COROUTINES
+
+namespace framework
+{
+    void StageTask::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+    {
+        // the frame can be destroyed as soon as done is set, so don't use the promise after
+        auto done = std::move(handle.promise().done);
+
+        if (!done)
+            return;
+
+        if (handle.promise().exception)
+            done->set_exception(handle.promise().exception);
+        else
+            done->set_value();
+    }
+
+
+    CoroutineStage::CoroutineStage(const string& name, const BufferConfig& bufferConfig, shared_ptr<Executor> executor)
+        :   PipelineStage(name, bufferConfig),
+            m_executor(std::move(executor)),
+            m_fixedExecutor(m_executor != nullptr)
+    {
+
+    }
+
+
+    void CoroutineStage::setExecutor(const shared_ptr<Executor>& executor)
+    {
+        PipelineStage::setExecutor(executor);
+
+        if (!m_fixedExecutor)
+            m_executor = executor;
+    }
+
+
+    std::shared_future<void> CoroutineStage::startDetached()
+    {
+        auto done = std::make_shared<std::promise<void>>();
+        auto finished = done->get_future().share();
+
+        if (!m_executor)
+            m_executor = Executor::shared();
+
+        m_task = runAsync();
+        m_task.handle().promise().done = std::move(done);
+
+        m_executor->post([handle = m_task.handle()] { handle.resume(); });
+
+        return finished;
+    }
+
+
+    void CoroutineStage::run()
+    {
+        startDetached().get();
+    }
+}
+
+#endif
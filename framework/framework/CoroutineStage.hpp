@@ -0,0 +1,266 @@
+#pragma once
+
+// requires C++20
+#if defined(__cpp_impl_coroutine)
+
+#define FRAMEWORK_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <memory>
+#include <utility>
+
+#include "PipelineStage.hpp"
+#include "Executor.hpp"
+
+
+namespace framework
+{
+    /// Return type of CoroutineStage::runAsync().
+    class StageTask
+    {
+    public:
+        struct promise_type;
+
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() noexcept {}
+        };
+
+
+        struct promise_type
+        {
+            StageTask get_return_object() { return StageTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+            /// started by CoroutineStage::startDetached(), on the executor
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            FinalAwaiter final_suspend() noexcept { return {}; }
+
+            void return_void() {}
+            void unhandled_exception() { exception = std::current_exception(); }
+
+            std::exception_ptr exception;
+            shared_ptr<std::promise<void>> done;
+        };
+
+
+        StageTask() = default;
+        StageTask(StageTask&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+        StageTask& operator=(StageTask&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                m_handle = std::exchange(other.m_handle, nullptr);
+            }
+
+            return *this;
+        }
+
+        ~StageTask()
+        {
+            reset();
+        }
+
+
+        std::coroutine_handle<promise_type> handle() const { return m_handle; }
+
+    private:
+        explicit StageTask(const std::coroutine_handle<promise_type> handle) : m_handle(handle)
+        {
+
+        }
+
+        StageTask(const StageTask&) = delete;
+        StageTask& operator=(const StageTask&) = delete;
+
+        void reset()
+        {
+            if (m_handle)
+                m_handle.destroy();
+
+            m_handle = nullptr;
+        }
+
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+
+    /// A stage written as a coroutine, which suspends rather than blocking a thread while it waits for data
+    /// and is resumed on a shared Executor. So unlike PipelineStage, which has a thread blocked in run() for
+    /// the life of the pipeline, the number of threads depends on the executor, not on the number of stages.
+    ///
+    ///     class Decode : public CoroutineStage
+    ///     {
+    ///         virtual StageTask runAsync() override
+    ///         {
+    ///             while (!shouldStop())
+    ///             {
+    ///                 if (auto data = co_await nextData<Packet>(); data)
+    ///                     co_await forward(decode(data));
+    ///             }
+    ///         }
+    ///     };
+    ///
+    /// runAsync() must not block, i.e. call PipelineStage::nextData() or dataComplete(), which wait on the thread.
+    /// Pause isn't supported, and a CoroutineStage can't be replicated with one shared input.
+    class CoroutineStage : public PipelineStage
+    {
+    public:
+        virtual bool needsThread() const override { return false; }
+
+        /// Starts runAsync() on the executor. The future is ready when it returns.
+        virtual std::shared_future<void> startDetached() override;
+
+        /// Runs runAsync() on the executor and waits for it to finish. Pipeline uses startDetached() instead.
+        virtual void run() override;
+
+        /// Used unless the stage was constructed with an executor.
+        virtual void setExecutor(const shared_ptr<Executor>& executor) override;
+
+
+    protected:
+        /// Waits, without blocking the thread, for the next item. Returns nullptr if the stage is stopping
+        /// or the data isn't a DataT.
+        template<class DataT>
+        class DataAwaiter : public EventCount::Waiter
+        {
+        public:
+            DataAwaiter(CoroutineStage& stage) : m_stage(stage)
+            {
+
+            }
+
+            bool await_ready()
+            {
+                if (m_stage.shouldStop())
+                    return true;
+
+                m_data = m_stage.PipelineStage::nextData<>(0ms);
+
+                return m_data != nullptr;
+            }
+
+            void await_suspend(const std::coroutine_handle<> handle)
+            {
+                m_handle = handle;
+                m_suspended = Clock::now();
+
+                // not registered: there's data already, or the input is closed
+                if (!m_stage.notifyOnData(*this))
+                    wake();
+            }
+
+            shared_ptr<DataT> await_resume()
+            {
+                if (m_handle)
+                {
+                    m_stage.addWaitTime(Clock::now() - m_suspended);
+
+                    if (!m_stage.shouldStop())
+                        m_data = m_stage.PipelineStage::nextData<>(0ms);
+                }
+
+                return std::dynamic_pointer_cast<DataT>(std::move(m_data));
+            }
+
+            virtual void wake() override
+            {
+                m_stage.m_executor->post([handle = m_handle] { handle.resume(); });
+            }
+
+        private:
+            CoroutineStage& m_stage;
+            shared_ptr<StageData> m_data;
+            std::coroutine_handle<> m_handle;
+            Clock::time_point m_suspended;
+        };
+
+
+        /// Passes data to the next stage(s) as dataComplete(), but while a next stage's buffer is full
+        /// the coroutine is suspended until the buffer notifies there's space, rather than blocking the thread.
+        class ForwardAwaiter : public EventCount::Waiter
+        {
+        public:
+            ForwardAwaiter(CoroutineStage& stage, shared_ptr<StageData>&& data) : m_stage(stage), m_data(std::move(data))
+            {
+
+            }
+
+            bool await_ready()
+            {
+                return !m_data || !m_stage.outputFull(*m_data) || m_stage.shouldStop();
+            }
+
+            void await_suspend(const std::coroutine_handle<> handle)
+            {
+                m_handle = handle;
+                m_suspended = Clock::now();
+
+                if (!m_stage.notifyOnSpace(*m_data, *this))
+                    wake();
+            }
+
+            BufferResult await_resume()
+            {
+                if (m_handle)
+                    m_stage.endForward(m_suspended, 0U);
+
+                return m_stage.dataComplete(std::move(m_data));
+            }
+
+            virtual void wake() override
+            {
+                m_stage.m_executor->post([this]
+                {
+                    if (!m_stage.outputFull(*m_data) || m_stage.shouldStop())
+                    {
+                        m_handle.resume();
+                    }
+                    else if (!m_stage.notifyOnSpace(*m_data, *this))
+                    {
+                        // not registered: there's space again since the check, so resume from a fresh post
+                        wake();
+                    }
+                });
+            }
+
+        private:
+            CoroutineStage& m_stage;
+            shared_ptr<StageData> m_data;
+            std::coroutine_handle<> m_handle;
+            Clock::time_point m_suspended;
+        };
+
+
+        /// bufferConfig as PipelineStage. Without an executor, the stage runs on its pipeline's executor 
+        /// (Pipeline::setExecutor()) or Executor::shared().
+        CoroutineStage(const string& name, const BufferConfig& bufferConfig = BufferConfig{}, shared_ptr<Executor> executor = nullptr);
+
+        /// The stage must be stopped, and runAsync() finished, before it's destroyed.
+        virtual ~CoroutineStage() = default;
+
+        /// The stage's body, instead of run().
+        virtual StageTask runAsync() = 0;
+
+
+        template<class DataT = StageData>
+        DataAwaiter<DataT> nextData() { return DataAwaiter<DataT>(*this); }
+
+        ForwardAwaiter forward(shared_ptr<StageData>&& data) { return ForwardAwaiter(*this, std::move(data)); }
+
+
+    private:
+        shared_ptr<Executor> m_executor;
+        const bool m_fixedExecutor;     ///< given in the constructor, so not replaced by setExecutor()
+        StageTask m_task;
+    };
+}
+
+#endif
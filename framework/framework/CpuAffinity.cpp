@@ -0,0 +1,221 @@
+#include "CpuAffinity.hpp"
+
+#include <string>
+#include <fstream>
+#include <thread>
+#include <cctype>
+
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+
+namespace framework
+{
+#ifdef __linux__
+
+    static int readSysInt(const std::string& path, const int fallback)
+    {
+        std::ifstream file(path);
+        int value = fallback;
+
+        if (file >> value)
+            return value;
+
+        return fallback;
+    }
+
+
+    static int cpuNode(const int cpu)
+    {
+        // the cpu's directory has a nodeN link
+        const std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        int node = 0;
+
+        if (DIR* dir = opendir(path.c_str()); dir)
+        {
+            while (const dirent* entry = readdir(dir))
+            {
+                const std::string name(entry->d_name);
+
+                if (name.size() > 4U && name.compare(0, 4, "node") == 0 && std::isdigit(static_cast<unsigned char>(name[4])))
+                {
+                    node = std::stoi(name.substr(4));
+                    break;
+                }
+            }
+
+            closedir(dir);
+        }
+
+        return node;
+    }
+
+
+    std::vector<CpuInfo> cpuTopology()
+    {
+        std::vector<CpuInfo> cpus;
+
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return cpus;
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                const std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+
+                cpus.push_back(CpuInfo{ cpu, readSysInt(topology + "core_id", cpu), readSysInt(topology + "physical_package_id", 0), cpuNode(cpu) });
+            }
+        }
+
+        return cpus;
+    }
+
+
+    bool pinThread(const int cpu)
+    {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return false;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+
+    ScopedAffinity::ScopedAffinity(const int cpu) : m_pinned(false)
+    {
+        cpu_set_t previous;
+        CPU_ZERO(&previous);
+
+        if (pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) == 0)
+        {
+            m_previous.assign(CPU_SETSIZE / 64, 0);
+
+            for (int i = 0; i < CPU_SETSIZE; ++i)
+            {
+                if (CPU_ISSET(i, &previous))
+                    m_previous[i / 64] |= 1ULL << (i % 64);
+            }
+
+            m_pinned = pinThread(cpu);
+        }
+    }
+
+
+    ScopedAffinity::~ScopedAffinity()
+    {
+        if (m_pinned)
+        {
+            cpu_set_t previous;
+            CPU_ZERO(&previous);
+
+            for (int i = 0; i < CPU_SETSIZE; ++i)
+            {
+                if (m_previous[i / 64] & (1ULL << (i % 64)))
+                    CPU_SET(i, &previous);
+            }
+
+            pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+        }
+    }
+
+#elif defined(_WIN32)
+
+    // only the calling thread's processor group, so at most 64 CPUs
+
+    std::vector<CpuInfo> cpuTopology()
+    {
+        std::vector<CpuInfo> cpus;
+
+        DWORD_PTR processMask = 0, systemMask = 0;
+
+        if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+            return cpus;
+
+        for (int cpu = 0; cpu < 64; ++cpu)
+        {
+            if (processMask & (static_cast<DWORD_PTR>(1) << cpu))
+            {
+                UCHAR node = 0;
+                GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node);
+
+                cpus.push_back(CpuInfo{ cpu, cpu, 0, node == 0xFF ? 0 : static_cast<int>(node) });
+            }
+        }
+
+        return cpus;
+    }
+
+
+    bool pinThread(const int cpu)
+    {
+        if (cpu < 0 || cpu >= 64)
+            return false;
+
+        return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0;
+    }
+
+
+    ScopedAffinity::ScopedAffinity(const int cpu) : m_pinned(false)
+    {
+        if (cpu >= 0 && cpu < 64)
+        {
+            if (const DWORD_PTR previous = SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu); previous)
+            {
+                m_previous.assign(1, static_cast<uint64_t>(previous));
+                m_pinned = true;
+            }
+        }
+    }
+
+
+    ScopedAffinity::~ScopedAffinity()
+    {
+        if (m_pinned)
+            SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(m_previous.front()));
+    }
+
+#else
+
+    std::vector<CpuInfo> cpuTopology()
+    {
+        std::vector<CpuInfo> cpus;
+
+        for (int cpu = 0; cpu < static_cast<int>(std::thread::hardware_concurrency()); ++cpu)
+            cpus.push_back(CpuInfo{ cpu, cpu, 0, 0 });
+
+        return cpus;
+    }
+
+
+    bool pinThread(const int)
+    {
+        return false;
+    }
+
+
+    ScopedAffinity::ScopedAffinity(const int) : m_pinned(false)
+    {
+
+    }
+
+
+    ScopedAffinity::~ScopedAffinity()
+    {
+
+    }
+
+#endif
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+
+namespace framework
+{
+    /// A logical CPU the process may run on.
+    struct CpuInfo
+    {
+        int cpu;        ///< logical CPU number, as used by pinThread()
+        int core;       ///< physical core, shared by hyperthread siblings
+        int package;    ///< socket
+        int node;       ///< NUMA node, memory first touched by a thread on this CPU is allocated from this node
+    };
+
+
+    /// The logical CPUs this process may run on, i.e. respecting taskset/cgroup limits, in CPU number order.
+    /// On Linux the topology is read from sysfs, elsewhere each CPU is treated as its own core on node 0.
+    std::vector<CpuInfo> cpuTopology();
+
+    /// Pins the calling thread to cpu. Returns false if that fails, i.e. the CPU doesn't exist or isn't allowed.
+    bool pinThread(const int cpu);
+
+
+    /// Pins the calling thread to a CPU until destroyed, then restores its previous affinity.
+    ///
+    /// Used to allocate memory on the NUMA node of the thread which will use it: with the default
+    /// (first touch) policy, pages come from the node of the CPU which first writes them.
+    class ScopedAffinity
+    {
+    public:
+        ScopedAffinity(const int cpu);
+        ~ScopedAffinity();
+
+        bool pinned() const { return m_pinned; }
+
+    private:
+        ScopedAffinity(const ScopedAffinity&) = delete;
+        ScopedAffinity& operator=(const ScopedAffinity&) = delete;
+
+    private:
+        bool m_pinned;
+        std::vector<uint64_t> m_previous;   ///< previous affinity, as a bit mask of CPUs
+    };
+}
@@ -0,0 +1,56 @@
+#include "EventCount.hpp"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#endif
+
+
+namespace framework
+{
+#ifdef __linux__
+
+    void EventCount::park(const uint32_t key, const std::chrono::steady_clock::duration& timeout)
+    {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+
+        timespec ts;
+        ts.tv_sec = static_cast<time_t>(ns / 1000000000LL);
+        ts.tv_nsec = static_cast<long>(ns % 1000000000LL);
+
+        // returns immediately if the epoch has already moved on from key
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAIT_PRIVATE, key, &ts, nullptr, 0);
+    }
+
+
+    void EventCount::wake(const bool all)
+    {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_epoch), FUTEX_WAKE_PRIVATE, all ? INT32_MAX : 1, nullptr, nullptr, 0);
+    }
+
+#else
+
+    void EventCount::park(const uint32_t key, const std::chrono::steady_clock::duration& timeout)
+    {
+        std::unique_lock lock(m_mux);
+        m_cv.wait_for(lock, timeout, [this, key] { return m_epoch.load() != key; });
+    }
+
+
+    void EventCount::wake(const bool all)
+    {
+        {
+            // a waiter is either before its predicate check, so sees the new epoch, or waiting
+            std::scoped_lock lock(m_mux);
+        }
+
+        if (all)
+            m_cv.notify_all();
+        else
+            m_cv.notify_one();
+    }
+
+#endif
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <mutex>
+
+#ifndef __linux__
+#include <condition_variable>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+
+namespace framework
+{
+    /// How a consumer waits for data.
+    enum class WakeStrategy
+    {
+        Block,          ///< park straight away. Nothing is used while idle, but waking costs a syscall
+        Spin,           ///< busy-spin until data arrives or the wait times out. Lowest latency, but uses a core even when idle
+        SpinYieldPark   ///< spin briefly, then yield, then park. Low latency under load without burning a core when idle
+    };
+
+
+    inline void cpuRelax()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+
+    /// Lets a consumer wait for a condition which a producer makes true, without a lock on the producer's side
+    /// and without lost wakeups: the producer changes the state, then calls notify. notify is an atomic load if nobody
+    /// is parked.
+    ///
+    /// On Linux, parking uses a futex, elsewhere a condition variable.
+    class EventCount
+    {
+    public:
+        static const unsigned SpinCount = 2000U;
+        static const unsigned YieldCount = 50U;
+
+
+        /// Notified instead of a parked thread, i.e. to resume a coroutine.
+        struct Waiter
+        {
+            virtual ~Waiter() = default;
+            virtual void wake() = 0;
+
+            Waiter* nextWaiter = nullptr;   ///< in the EventCount's list while registered
+        };
+
+
+        EventCount() : m_epoch(0), m_waiters(0), m_asyncWaiters(0), m_asyncHead(nullptr), m_asyncTail(nullptr)
+        {
+
+        }
+
+
+        void notifyOne()
+        {
+            notify(false);
+        }
+
+
+        void notifyAll()
+        {
+            notify(true);
+        }
+
+
+        /// Waits until ready() or waitMs has passed, returns ready().
+        template<class Pred>
+        bool waitFor(Pred ready, const std::chrono::milliseconds& waitMs, const WakeStrategy strategy)
+        {
+            if (ready())
+                return true;
+
+            if (waitMs.count() <= 0)
+                return false;
+
+            const auto deadline = std::chrono::steady_clock::now() + waitMs;
+
+            if (strategy != WakeStrategy::Block)
+            {
+                for (unsigned i = 1; strategy == WakeStrategy::Spin || i < SpinCount + YieldCount; ++i)
+                {
+                    if (ready())
+                        return true;
+
+                    if ((i % 64U) == 0 && std::chrono::steady_clock::now() >= deadline)
+                        return ready();
+
+                    if (i < SpinCount || strategy == WakeStrategy::Spin)
+                        cpuRelax();
+                    else
+                        std::this_thread::yield();
+                }
+            }
+
+            while (true)
+            {
+                const uint32_t key = prepareWait();
+
+                if (ready())
+                {
+                    finishWait();
+                    return true;
+                }
+
+                const auto now = std::chrono::steady_clock::now();
+
+                if (now >= deadline)
+                {
+                    finishWait();
+                    return false;
+                }
+
+                park(key, deadline - now);
+                finishWait();
+
+                if (ready())
+                    return true;
+            }
+        }
+
+
+        /// Arranges for waiter.wake() to be called once, by a later notify: notifyOne() wakes the longest registered
+        /// Waiter, notifyAll() every one. Returns false, without arranging a call, if ready() already.
+        /// A Waiter can only be registered once at a time.
+        template<class Pred>
+        bool waitAsync(Waiter& waiter, Pred ready)
+        {
+            if (ready())
+                return false;
+
+            {
+                std::scoped_lock lock(m_asyncMux);
+
+                waiter.nextWaiter = nullptr;
+                (m_asyncTail ? m_asyncTail->nextWaiter : m_asyncHead) = &waiter;
+                m_asyncTail = &waiter;
+                m_asyncWaiters.fetch_add(1U, std::memory_order_seq_cst);
+            }
+
+            // pairs with the fence in notify(): either the producer sees the waiter or we see its change
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            // if it isn't in the list, a notify has taken the waiter and will wake it
+            if (ready() && removeAsync(waiter))
+                return false;
+
+            return true;
+        }
+
+
+    private:
+        EventCount(const EventCount&) = delete;
+        EventCount& operator=(const EventCount&) = delete;
+
+
+        uint32_t prepareWait()
+        {
+            m_waiters.fetch_add(1U, std::memory_order_seq_cst);
+            return m_epoch.load(std::memory_order_seq_cst);
+        }
+
+
+        void finishWait()
+        {
+            m_waiters.fetch_sub(1U, std::memory_order_relaxed);
+        }
+
+
+        void notify(const bool all)
+        {
+            // order the producer's change before the check for waiters, pairs with prepareWait()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (m_waiters.load(std::memory_order_relaxed) != 0)
+            {
+                m_epoch.fetch_add(1U, std::memory_order_seq_cst);
+                wake(all);
+            }
+
+            if (m_asyncWaiters.load(std::memory_order_relaxed) != 0)
+            {
+                Waiter* waiter = takeAsync(all);
+
+                while (waiter)
+                {
+                    // read first, once woken the waiter may register again
+                    Waiter* next = waiter->nextWaiter;
+                    waiter->wake();
+                    waiter = next;
+                }
+            }
+        }
+
+
+        /// Unlinks the first registered Waiter, or all of them, and returns the first.
+        Waiter* takeAsync(const bool all)
+        {
+            std::scoped_lock lock(m_asyncMux);
+
+            Waiter* first = m_asyncHead;
+
+            if (!first)
+                return nullptr;
+
+            if (all)
+            {
+                m_asyncHead = m_asyncTail = nullptr;
+                m_asyncWaiters.store(0U, std::memory_order_relaxed);
+            }
+            else
+            {
+                m_asyncHead = first->nextWaiter;
+
+                if (!m_asyncHead)
+                    m_asyncTail = nullptr;
+
+                first->nextWaiter = nullptr;
+                m_asyncWaiters.fetch_sub(1U, std::memory_order_relaxed);
+            }
+
+            return first;
+        }
+
+
+        /// Returns false if the waiter isn't registered, i.e. a notify has taken it.
+        bool removeAsync(Waiter& waiter)
+        {
+            std::scoped_lock lock(m_asyncMux);
+
+            Waiter* previous = nullptr;
+
+            for (Waiter* w = m_asyncHead; w; previous = w, w = w->nextWaiter)
+            {
+                if (w == &waiter)
+                {
+                    (previous ? previous->nextWaiter : m_asyncHead) = w->nextWaiter;
+
+                    if (m_asyncTail == w)
+                        m_asyncTail = previous;
+
+                    w->nextWaiter = nullptr;
+                    m_asyncWaiters.fetch_sub(1U, std::memory_order_relaxed);
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+
+        void park(const uint32_t key, const std::chrono::steady_clock::duration& timeout);
+        void wake(const bool all);
+
+
+    private:
+        std::atomic<uint32_t> m_epoch;
+        std::atomic<uint32_t> m_waiters;
+
+        // Waiters registered by waitAsync(), oldest first. The count lets notify skip the lock when there are none.
+        std::atomic<uint32_t> m_asyncWaiters;
+        std::mutex m_asyncMux;
+        Waiter* m_asyncHead;
+        Waiter* m_asyncTail;
+
+#ifndef __linux__
+        std::mutex m_mux;
+        std::condition_variable m_cv;
+#endif
+    };
+}
@@ -0,0 +1,273 @@
+#include "Executor.hpp"
+
+
+namespace framework
+{
+    // the executor and worker the current thread belongs to, so tasks posted by a task stay on its worker
+    static thread_local const Executor* t_executor = nullptr;
+    static thread_local size_t t_worker = 0;
+
+
+    Executor::Executor(const size_t nThreads) : m_nextWorker(0), m_pending(0), m_sleepers(0), m_stop(false), m_blockingIdle(0)
+    {
+        const size_t n = nThreads ? nThreads : std::max(1U, std::thread::hardware_concurrency());
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+
+        // start once all the queues exist, they steal from each other
+        for (size_t i = 0; i < n; ++i)
+        {
+            m_workers[i]->thread = std::thread([this, i] { work(i); });
+        }
+    }
+
+
+    Executor::~Executor()
+    {
+        {
+            std::scoped_lock lock(m_sleepMux);
+            m_stop = true;
+        }
+
+        m_sleepCV.notify_all();
+
+        for (auto& worker : m_workers)
+        {
+            if (worker->thread.joinable())
+                worker->thread.join();
+        }
+
+        {
+            std::scoped_lock lock(m_blockingMux);
+        }
+
+        m_blockingCV.notify_all();
+
+        for (auto& thread : m_blockingThreads)
+        {
+            if (thread.joinable())
+                thread.join();
+        }
+    }
+
+
+    void Executor::post(Task task)
+    {
+        const size_t index = t_executor == this ? t_worker : m_nextWorker.fetch_add(1U, std::memory_order_relaxed) % m_workers.size();
+
+        // counted before it's queued, so a worker never sees fewer pending than are queued
+        m_pending.fetch_add(1U);
+
+        {
+            std::scoped_lock lock(m_workers[index]->mux);
+            m_workers[index]->tasks.push_back(std::move(task));
+        }
+
+        if (m_sleepers.load() != 0)
+        {
+            {
+                // a worker going to sleep either sees m_pending or is waiting
+                std::scoped_lock lock(m_sleepMux);
+            }
+
+            m_sleepCV.notify_one();
+        }
+    }
+
+
+    std::shared_future<void> Executor::runBlocking(Task task)
+    {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+        auto finished = packaged->get_future().share();
+
+        {
+            std::scoped_lock lock(m_blockingMux);
+
+            m_blockingTasks.push_back([packaged] { (*packaged)(); });
+
+            // idle threads take a task each, the rest need a new thread
+            if (m_blockingTasks.size() > m_blockingIdle)
+            {
+                m_blockingThreads.emplace_back([this] { blockingWork(); });
+            }
+        }
+
+        m_blockingCV.notify_one();
+
+        return finished;
+    }
+
+
+    void Executor::parallelFor(const size_t count, const std::function<void(size_t)>& body)
+    {
+        struct Loop
+        {
+            const std::function<void(size_t)>* body;
+            size_t count;
+            std::atomic_size_t next;
+            std::atomic_size_t done;
+            std::mutex mux;
+            std::condition_variable cv;
+            std::exception_ptr error;
+        };
+
+        if (count == 0)
+            return;
+
+        // shared, helpers which start after the last index was taken still look at it
+        auto loop = std::make_shared<Loop>();
+        loop->body = &body;
+        loop->count = count;
+        loop->next = 0;
+        loop->done = 0;
+
+        auto run = [](Loop& loop)
+        {
+            size_t finished = 0;
+
+            for (size_t i = loop.next.fetch_add(1U); i < loop.count; i = loop.next.fetch_add(1U), ++finished)
+            {
+                try
+                {
+                    (*loop.body)(i);
+                }
+                catch (...)
+                {
+                    std::scoped_lock lock(loop.mux);
+
+                    if (!loop.error)
+                        loop.error = std::current_exception();
+                }
+            }
+
+            // body isn't used once every index is done, the caller may have returned
+            if (finished && loop.done.fetch_add(finished) + finished == loop.count)
+            {
+                {
+                    std::scoped_lock lock(loop.mux);
+                }
+
+                loop.cv.notify_all();
+            }
+        };
+
+        const size_t helpers = std::min(m_workers.size(), count - 1U);
+
+        for (size_t i = 0; i < helpers; ++i)
+        {
+            post([loop, run] { run(*loop); });
+        }
+
+        run(*loop);
+
+        std::unique_lock lock(loop->mux);
+        loop->cv.wait(lock, [&loop] { return loop->done.load() == loop->count; });
+
+        if (loop->error)
+            std::rethrow_exception(loop->error);
+    }
+
+
+    std::shared_ptr<Executor> Executor::shared()
+    {
+        static std::shared_ptr<Executor> executor = std::make_shared<Executor>();
+        return executor;
+    }
+
+
+    void Executor::work(const size_t index)
+    {
+        static const unsigned SpinCount = 64U;
+
+        t_executor = this;
+        t_worker = index;
+
+        Task task;
+
+        while (!m_stop.load())
+        {
+            bool found = take(index, task);
+
+            for (unsigned i = 0; !found && i < SpinCount && m_pending.load() != 0; ++i)
+            {
+                std::this_thread::yield();
+                found = take(index, task);
+            }
+
+            if (found)
+            {
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock lock(m_sleepMux);
+
+            m_sleepers.fetch_add(1U);
+            m_sleepCV.wait(lock, [this] { return m_stop.load() || m_pending.load() != 0; });
+            m_sleepers.fetch_sub(1U);
+        }
+    }
+
+
+    bool Executor::take(const size_t index, Task& task)
+    {
+        {
+            auto& own = *m_workers[index];
+            std::scoped_lock lock(own.mux);
+
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+                m_pending.fetch_sub(1U);
+                return true;
+            }
+        }
+
+        // steal the most recently queued, the owner takes from the front
+        for (size_t i = 1; i < m_workers.size(); ++i)
+        {
+            auto& victim = *m_workers[(index + i) % m_workers.size()];
+            std::scoped_lock lock(victim.mux);
+
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                m_pending.fetch_sub(1U);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+    void Executor::blockingWork()
+    {
+        while (true)
+        {
+            Task task;
+
+            {
+                std::unique_lock lock(m_blockingMux);
+
+                ++m_blockingIdle;
+                m_blockingCV.wait(lock, [this] { return m_stop.load() || !m_blockingTasks.empty(); });
+                --m_blockingIdle;
+
+                if (m_blockingTasks.empty())
+                    return;
+
+                task = std::move(m_blockingTasks.front());
+                m_blockingTasks.pop_front();
+            }
+
+            task();
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <exception>
+
+
+namespace framework
+{
+    /// A process wide set of threads shared by many pipelines, see Pipeline::setExecutor().
+    ///
+    /// Short tasks, i.e. resuming CoroutineStages, run on a fixed number of worker threads, so the number of
+    /// threads scales with cores rather than stages. Each worker has its own run queue: a task posted from a
+    /// worker goes on that worker's queue, others are spread across the queues, and a worker with nothing to
+    /// do steals from the others. So a busy pipeline's tasks run on workers idle pipelines aren't using.
+    /// Tasks posted to the workers must not block.
+    ///
+    /// Blocking tasks, i.e. a PipelineStage's run(), are given a thread each by runBlocking(). These threads
+    /// are kept when the task finishes and reused, rather than each pipeline having a thread pool.
+    ///
+    /// Unlike ctpl::thread_pool, post() doesn't create a future per task.
+    class Executor
+    {
+    public:
+        using Task = std::function<void()>;
+
+
+        /// 0 threads is one per hardware thread.
+        Executor(const size_t nThreads = 0);
+        ~Executor();
+
+        void post(Task task);
+
+        /// Runs a task which may block on a thread of its own. The future is ready when it returns.
+        std::shared_future<void> runBlocking(Task task);
+
+        /// Calls body(i) for each i in [0, count), on the workers and the calling thread, and returns when all have
+        /// returned. For splitting one large item into independent parts, i.e. the chunks of a payload. The calling
+        /// thread takes indexes too, so this also works from a task on a worker, which must not block waiting for others.
+        /// If a body throws, the other indexes still run and the first exception is rethrown.
+        void parallelFor(const size_t count, const std::function<void(size_t)>& body);
+
+        size_t threadCount() const { return m_workers.size(); }
+
+        /// Process wide executor, created on first use.
+        static std::shared_ptr<Executor> shared();
+
+    private:
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+
+        struct alignas(64) Worker
+        {
+            std::mutex mux;
+            std::deque<Task> tasks;
+            std::thread thread;
+        };
+
+
+        void work(const size_t index);
+        bool take(const size_t index, Task& task);
+        void blockingWork();
+
+    private:
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::atomic_size_t m_nextWorker;
+        std::atomic_size_t m_pending;   ///< tasks queued on any worker
+        std::atomic_size_t m_sleepers;
+        std::mutex m_sleepMux;
+        std::condition_variable m_sleepCV;
+        std::atomic_bool m_stop;
+
+        std::mutex m_blockingMux;
+        std::condition_variable m_blockingCV;
+        std::deque<Task> m_blockingTasks;
+        std::vector<std::thread> m_blockingThreads;
+        size_t m_blockingIdle;
+    };
+}
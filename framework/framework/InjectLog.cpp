@@ -0,0 +1,166 @@
+#include "InjectLog.hpp"
+#include "Pipeline.hpp"
+
+#include <thread>
+#include <cstring>
+#include <limits>
+
+#include "Logger.hpp"
+
+
+namespace framework
+{
+    static const char LogMagic[8] = { 'F', 'W', 'I', 'N', 'J', 'L', 'O', 'G' };
+    static const uint32_t LogVersion = 2U;
+
+
+    /// Fixed size part of a record, followed by size bytes of the serialized item. Written field by field, 
+    /// little endian, so the log doesn't depend on the compiler's struct layout.
+    struct RecordHeader
+    {
+        int64_t offset;     ///< nanoseconds since the first record
+        uint64_t size;
+        uint32_t stage;
+
+        static const size_t Bytes = 8U + 8U + 4U;
+
+        void write(char* out) const
+        {
+            putLittleEndian(out, static_cast<uint64_t>(offset), 8U);
+            putLittleEndian(out + 8U, size, 8U);
+            putLittleEndian(out + 16U, stage, 4U);
+        }
+
+        void read(const char* in)
+        {
+            offset = static_cast<int64_t>(getLittleEndian(in, 8U));
+            size = getLittleEndian(in + 8U, 8U);
+            stage = static_cast<uint32_t>(getLittleEndian(in + 16U, 4U));
+        }
+
+        static void putLittleEndian(char* out, const uint64_t value, const size_t bytes)
+        {
+            for (size_t i = 0; i < bytes; ++i)
+                out[i] = static_cast<char>((value >> (8U * i)) & 0xFFU);
+        }
+
+        static uint64_t getLittleEndian(const char* in, const size_t bytes)
+        {
+            uint64_t value = 0;
+
+            for (size_t i = 0; i < bytes; ++i)
+                value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8U * i);
+
+            return value;
+        }
+    };
+
+
+    InjectRecorder::InjectRecorder(const string& path, Serializer serializer) 
+        : m_serializer(std::move(serializer)), m_file(path, std::ios::binary | std::ios::trunc), m_count(0)
+    {
+        if (!m_file || !m_serializer)
+            throw std::runtime_error("InjectRecorder: can't create " + path + " or no serializer");
+
+        char version[sizeof(LogVersion)];
+        RecordHeader::putLittleEndian(version, LogVersion, sizeof(version));
+
+        m_file.write(LogMagic, sizeof(LogMagic));
+        m_file.write(version, sizeof(version));
+    }
+
+
+    void InjectRecorder::record(const StageData& data, const StageId stageId)
+    {
+        std::scoped_lock lock(m_mux);
+
+        // inside the lock, so the offsets of records from several threads increase in the order they're written
+        const auto now = std::chrono::steady_clock::now();
+
+        if (m_count++ == 0)
+            m_start = now;
+
+        m_record.resize(RecordHeader::Bytes);
+        m_serializer(data, m_record);
+
+        RecordHeader header{};
+        header.offset = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count(), 0);
+        header.size = m_record.size() - RecordHeader::Bytes;
+        header.stage = stageId;
+
+        header.write(m_record.data());
+
+        m_file.write(m_record.data(), static_cast<std::streamsize>(m_record.size()));
+    }
+
+
+    void InjectRecorder::flush()
+    {
+        std::scoped_lock lock(m_mux);
+        m_file.flush();
+    }
+
+
+    InjectReplayer::InjectReplayer(const string& path, Deserializer deserializer) : m_path(path), m_deserializer(std::move(deserializer))
+    {
+        std::ifstream file(m_path, std::ios::binary);
+        char magic[sizeof(LogMagic)] = {};
+        char version[sizeof(LogVersion)] = {};
+
+        file.read(magic, sizeof(magic));
+        file.read(version, sizeof(version));
+
+        if (!file || std::memcmp(magic, LogMagic, sizeof(magic)) != 0 || RecordHeader::getLittleEndian(version, sizeof(version)) != LogVersion || !m_deserializer)
+            throw std::runtime_error("InjectReplayer: " + path + " isn't an inject log or no deserializer");
+    }
+
+
+    InjectReplayer::Stats InjectReplayer::replay(Pipeline& pipeline, const double speed)
+    {
+        std::ifstream file(m_path, std::ios::binary | std::ios::ate);
+        const std::streamoff fileSize = file.tellg();
+        file.seekg(sizeof(LogMagic) + sizeof(LogVersion));
+
+        Stats stats;
+        RecordHeader header{};
+        char headerBytes[RecordHeader::Bytes];
+        std::vector<char> bytes;
+        const auto start = std::chrono::steady_clock::now();
+
+        while (file.read(headerBytes, sizeof(headerBytes)))
+        {
+            header.read(headerBytes);
+
+            // a corrupt or cut off log mustn't size the buffer
+            if (header.size > static_cast<uint64_t>(fileSize - file.tellg()) || header.stage > std::numeric_limits<StageId>::max())
+            {
+                logg("InjectReplayer: " + m_path + " is corrupt or cut off after " + std::to_string(stats.items) + " records");
+                break;
+            }
+
+            bytes.resize(static_cast<size_t>(header.size));
+
+            if (!file.read(bytes.data(), static_cast<std::streamsize>(bytes.size())))
+                break;
+
+            if (speed > 0.0)
+            {
+                const auto due = start + std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(header.offset) / speed));
+                std::this_thread::sleep_until(due);
+            }
+
+            if (auto data = m_deserializer(bytes.data(), bytes.size()); !data || pipeline.injectData(data, static_cast<StageId>(header.stage)) != BufferResult::Added)
+                ++stats.notAdded;
+
+            ++stats.items;
+            stats.recorded = std::chrono::nanoseconds(header.offset);
+        }
+
+        if (file.eof() && file.gcount() > 0)
+            logg("InjectReplayer: " + m_path + " is cut off after " + std::to_string(stats.items) + " records");
+
+        stats.elapsed = std::chrono::steady_clock::now() - start;
+
+        return stats;
+    }
+}
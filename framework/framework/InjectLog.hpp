@@ -0,0 +1,88 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "PipelineStage.hpp"
+
+
+namespace framework
+{
+    using std::shared_ptr;
+    using std::string;
+
+    class Pipeline;
+
+
+    /// Writes every item injected into a pipeline, with when it was injected and which stage it was injected to,
+    /// to a binary log which InjectReplayer can feed back, i.e. to reproduce production load offline.
+    /// See Pipeline::setRecorder().
+    ///
+    /// Each record is the time since the first record, the size of the serialized item and the stage id, as 8, 8 and 
+    /// 4 byte little endian integers, then the serialized item.
+    class InjectRecorder
+    {
+    public:
+        /// Appends the item's bytes to the vector.
+        using Serializer = std::function<void(const StageData&, std::vector<char>&)>;
+
+
+        /// Throws std::runtime_error if the file can't be created.
+        InjectRecorder(const string& path, Serializer serializer);
+
+        /// Thread safe, items injected from several threads are logged in the order they're recorded.
+        void record(const StageData& data, const StageId stageId);
+
+        void flush();
+
+        uint64_t count() const { return m_count; }
+
+    private:
+        InjectRecorder(const InjectRecorder&) = delete;
+        InjectRecorder& operator=(const InjectRecorder&) = delete;
+
+    private:
+        Serializer m_serializer;
+        std::ofstream m_file;
+        std::mutex m_mux;
+        std::vector<char> m_record;
+        std::chrono::steady_clock::time_point m_start;
+        std::atomic<uint64_t> m_count;     ///< read by count() without the lock
+    };
+
+
+    /// Feeds a log written by InjectRecorder into a pipeline.
+    class InjectReplayer
+    {
+    public:
+        using Deserializer = std::function<shared_ptr<StageData>(const char*, const size_t)>;
+
+        struct Stats
+        {
+            uint64_t items = 0;
+            uint64_t notAdded = 0;      ///< injectData() didn't return BufferResult::Added
+            std::chrono::nanoseconds elapsed{ 0 };
+            std::chrono::nanoseconds recorded{ 0 };     ///< from the first record to the last, as recorded
+        };
+
+
+        /// Throws std::runtime_error if the file can't be opened or isn't a log.
+        InjectReplayer(const string& path, Deserializer deserializer);
+
+        /// Injects every item in the log to the stage it was recorded for. With a speed > 0, items are injected at
+        /// the recorded times divided by speed, so 1 is the original rate and 2 twice as fast. With 0, as fast as 
+        /// the pipeline accepts them. Can be called again to replay the log again.
+        Stats replay(Pipeline& pipeline, const double speed = 1.0);
+
+    private:
+        string m_path;
+        Deserializer m_deserializer;
+    };
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+
+namespace framework
+{
+    /// Log-linear bucketing, as HDR histograms: values below SubBucketCount have their own bucket, above that each
+    /// power of two is split into SubBucketCount buckets, so a value is recorded to within 1/SubBucketCount (~3%).
+    struct LatencyBuckets
+    {
+        static const unsigned SubBucketBits = 5U;
+        static const uint64_t SubBucketCount = 1ULL << SubBucketBits;
+        static const size_t BucketCount = (64U - SubBucketBits + 1U) * SubBucketCount;
+
+
+        static size_t index(const uint64_t value)
+        {
+            if (value < SubBucketCount)
+                return static_cast<size_t>(value);
+
+            const unsigned shift = msb(value) - SubBucketBits;
+
+            return static_cast<size_t>(((shift + 1U) << SubBucketBits) + ((value >> shift) & (SubBucketCount - 1U)));
+        }
+
+
+        /// The highest value recorded in bucket i.
+        static uint64_t highest(const size_t i)
+        {
+            if (i < SubBucketCount)
+                return i;
+
+            const unsigned shift = static_cast<unsigned>(i >> SubBucketBits) - 1U;
+            const uint64_t lowest = (SubBucketCount + (i & (SubBucketCount - 1U))) << shift;
+
+            return lowest + ((1ULL << shift) - 1U);
+        }
+
+
+        static unsigned msb(const uint64_t value)
+        {
+#ifdef _MSC_VER
+            unsigned long bit;
+            _BitScanReverse64(&bit, value);
+            return static_cast<unsigned>(bit);
+#else
+            return 63U - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+        }
+    };
+
+
+    /// Counts from a LatencyHistogram, which can be merged and queried.
+    class LatencySnapshot
+    {
+    public:
+        LatencySnapshot() : m_counts(LatencyBuckets::BucketCount, 0), m_count(0), m_max(0)
+        {
+
+        }
+
+
+        uint64_t count() const { return m_count; }
+        std::chrono::nanoseconds max() const { return std::chrono::nanoseconds(m_max); }
+
+        std::chrono::nanoseconds p50() const { return percentile(50.0); }
+        std::chrono::nanoseconds p99() const { return percentile(99.0); }
+        std::chrono::nanoseconds p999() const { return percentile(99.9); }
+
+
+        /// The value at or below which p percent of values were recorded, to the histogram's precision. 0 if empty.
+        std::chrono::nanoseconds percentile(const double p) const
+        {
+            if (m_count == 0)
+                return std::chrono::nanoseconds::zero();
+
+            const uint64_t rank = std::max<uint64_t>(1U, static_cast<uint64_t>(std::clamp(p, 0.0, 100.0) / 100.0 * static_cast<double>(m_count) + 0.5));
+            uint64_t seen = 0;
+
+            for (size_t i = 0; i < m_counts.size(); ++i)
+            {
+                seen += m_counts[i];
+
+                if (seen >= rank)
+                    return std::chrono::nanoseconds(static_cast<int64_t>(std::min(LatencyBuckets::highest(i), m_max)));
+            }
+
+            return max();
+        }
+
+
+        void merge(const LatencySnapshot& other)
+        {
+            for (size_t i = 0; i < m_counts.size(); ++i)
+                m_counts[i] += other.m_counts[i];
+
+            m_count += other.m_count;
+            m_max = std::max(m_max, other.m_max);
+        }
+
+
+    private:
+        friend class LatencyHistogram;
+
+        std::vector<uint64_t> m_counts;
+        uint64_t m_count;
+        uint64_t m_max;
+    };
+
+
+    /// Records durations without locking. Only one thread may record, i.e. the stage's own thread,
+    /// but any thread can take a snapshot().
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram() : m_max(0)
+        {
+            for (auto& count : m_counts)
+                count.store(0, std::memory_order_relaxed);
+        }
+
+
+        void record(const std::chrono::nanoseconds& duration)
+        {
+            const uint64_t value = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+            auto& count = m_counts[LatencyBuckets::index(value)];
+
+            // single writer, so no locked read-modify-write
+            count.store(count.load(std::memory_order_relaxed) + 1U, std::memory_order_relaxed);
+
+            if (value > m_max.load(std::memory_order_relaxed))
+                m_max.store(value, std::memory_order_relaxed);
+        }
+
+
+        LatencySnapshot snapshot() const
+        {
+            LatencySnapshot snapshot;
+
+            for (size_t i = 0; i < m_counts.size(); ++i)
+            {
+                snapshot.m_counts[i] = m_counts[i].load(std::memory_order_relaxed);
+                snapshot.m_count += snapshot.m_counts[i];
+            }
+
+            snapshot.m_max = m_max.load(std::memory_order_relaxed);
+
+            return snapshot;
+        }
+
+
+    private:
+        LatencyHistogram(const LatencyHistogram&) = delete;
+        LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+
+    private:
+        std::array<std::atomic_uint64_t, LatencyBuckets::BucketCount> m_counts;
+        std::atomic_uint64_t m_max;
+    };
+}
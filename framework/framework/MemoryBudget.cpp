@@ -0,0 +1,83 @@
+#include "MemoryBudget.hpp"
+
+
+namespace framework
+{
+    MemoryBudget::MemoryBudget(const size_t limit, const bool block) : m_limit(limit), m_block(block), m_used(0), m_waiters(0), m_closed(false)
+    {
+
+    }
+
+
+    bool MemoryBudget::acquire(const size_t bytes)
+    {
+        size_t used = m_used.load();
+
+        while (!m_closed.load())
+        {
+            if (used == 0 || used + bytes <= m_limit)
+            {
+                if (m_used.compare_exchange_weak(used, used + bytes))
+                    return true;
+
+                continue;
+            }
+
+            if (!m_block)
+                return false;
+
+            std::unique_lock lock(m_mux);
+
+            ++m_waiters;
+            m_cv.wait(lock, [this, bytes] 
+            { 
+                const size_t now = m_used.load();
+                return m_closed.load() || now == 0 || now + bytes <= m_limit; 
+            });
+            --m_waiters;
+
+            used = m_used.load();
+        }
+
+        return false;
+    }
+
+
+    void MemoryBudget::charge(const size_t bytes)
+    {
+        m_used.fetch_add(bytes);
+    }
+
+
+    void MemoryBudget::release(const size_t bytes)
+    {
+        m_used.fetch_sub(bytes);
+
+        if (m_waiters.load() != 0)
+        {
+            {
+                // a producer about to wait either sees the new total or is waiting
+                std::scoped_lock lock(m_mux);
+            }
+
+            m_cv.notify_all();
+        }
+    }
+
+
+    void MemoryBudget::close()
+    {
+        {
+            std::scoped_lock lock(m_mux);
+            m_closed.store(true);
+        }
+
+        m_cv.notify_all();
+    }
+
+
+    void MemoryBudget::open()
+    {
+        m_closed.store(false);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace framework
+{
+    /// A cap on the bytes of StageData queued in a pipeline's stage buffers, see Pipeline::setMemoryBudget().
+    ///
+    /// Data entering the pipeline acquire()s its bytes, which waits, or fails, while the budget is used up.
+    /// Data moving between stages is charge()d without waiting, since the stage that would free space may be
+    /// the one waiting. The bytes are released when a stage takes the data from its buffer.
+    class MemoryBudget
+    {
+    public:
+        /// If block, acquire() waits for space, otherwise it fails.
+        MemoryBudget(const size_t limit, const bool block = true);
+
+        /// Returns false if bytes don't fit and the budget doesn't block, or it's closed while waiting. 
+        /// Data larger than the whole budget is let in when nothing else is in flight.
+        bool acquire(const size_t bytes);
+
+        void charge(const size_t bytes);
+        void release(const size_t bytes);
+
+        /// Releases waiting producers, acquire() fails until open() is called, i.e. while the pipeline is stopped.
+        void close();
+        void open();
+
+        bool closed() const { return m_closed.load(); }
+
+        size_t used() const { return m_used.load(); }
+        size_t limit() const { return m_limit; }
+
+    private:
+        MemoryBudget(const MemoryBudget&) = delete;
+        MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    private:
+        const size_t m_limit;
+        const bool m_block;
+        std::atomic_size_t m_used;
+        std::atomic_size_t m_waiters;
+        std::atomic_bool m_closed;
+        std::mutex m_mux;
+        std::condition_variable m_cv;
+    };
+}
@@ -0,0 +1,275 @@
+#include "PayloadBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+
+namespace framework
+{
+    static const std::align_val_t BlockAlignment{ alignof(PayloadBlock) };
+
+
+    /// Bytes from one block's header to the next in a slab, so each header is aligned.
+    static size_t blockStride(const size_t blockSize)
+    {
+        const size_t align = alignof(PayloadBlock);
+        return sizeof(PayloadBlock) + (blockSize + align - 1U) / align * align;
+    }
+
+
+    PayloadSlice PayloadSlice::slice(const size_t offset, const size_t length) const
+    {
+        if (offset > m_size || length > m_size - offset)
+            throw std::out_of_range("PayloadSlice::slice() outside the slice");
+
+        if (m_block)
+            m_block->refs.fetch_add(1U, std::memory_order_relaxed);
+
+        return PayloadSlice(m_block, m_offset + offset, length);
+    }
+
+
+    void PayloadSlice::truncate(const size_t size)
+    {
+        m_size = std::min(m_size, size);
+    }
+
+
+    void PayloadSlice::consume(const size_t n)
+    {
+        const size_t consumed = std::min(m_size, n);
+
+        m_offset += consumed;
+        m_size -= consumed;
+    }
+
+
+    void PayloadSlice::release()
+    {
+        // acq_rel so writes through every slice happen before the block is reused
+        if (m_block && m_block->refs.fetch_sub(1U, std::memory_order_acq_rel) == 1U)
+            PayloadPool::release(m_block);
+
+        m_block = nullptr;
+    }
+
+
+    void PayloadChain::append(PayloadSlice slice)
+    {
+        if (slice.empty())
+            return;
+
+        m_size += slice.size();
+        m_slices.push_back(std::move(slice));
+    }
+
+
+    void PayloadChain::append(const PayloadChain& chain)
+    {
+        for (const auto& slice : chain)
+            append(slice);
+    }
+
+
+    PayloadChain PayloadChain::slice(const size_t offset, const size_t length) const
+    {
+        if (offset > m_size || length > m_size - offset)
+            throw std::out_of_range("PayloadChain::slice() outside the chain");
+
+        PayloadChain chain;
+        size_t skip = offset;
+        size_t remaining = length;
+
+        for (auto slice = m_slices.begin(); slice != m_slices.end() && remaining; ++slice)
+        {
+            if (skip >= slice->size())
+            {
+                skip -= slice->size();
+                continue;
+            }
+
+            const size_t n = std::min(slice->size() - skip, remaining);
+
+            chain.append(slice->slice(skip, n));
+            remaining -= n;
+            skip = 0;
+        }
+
+        return chain;
+    }
+
+
+    void PayloadChain::truncate(const size_t size)
+    {
+        if (size >= m_size)
+            return;
+
+        size_t kept = 0;
+        auto slice = m_slices.begin();
+
+        for ( ; slice != m_slices.end() && kept < size; ++slice)
+        {
+            slice->truncate(size - kept);
+            kept += slice->size();
+        }
+
+        m_slices.erase(slice, m_slices.end());
+        m_size = size;
+    }
+
+
+    void PayloadChain::consume(const size_t n)
+    {
+        size_t remaining = std::min(n, m_size);
+        auto slice = m_slices.begin();
+
+        m_size -= remaining;
+
+        for ( ; slice != m_slices.end() && remaining >= slice->size(); ++slice)
+            remaining -= slice->size();
+
+        if (slice != m_slices.end())
+            slice->consume(remaining);
+
+        m_slices.erase(m_slices.begin(), slice);
+    }
+
+
+    size_t PayloadChain::copyTo(char* dest, const size_t offset, const size_t length) const
+    {
+        size_t skip = offset;
+        size_t copied = 0;
+
+        for (auto slice = m_slices.begin(); slice != m_slices.end() && copied < length; ++slice)
+        {
+            if (skip >= slice->size())
+            {
+                skip -= slice->size();
+                continue;
+            }
+
+            const size_t n = std::min(slice->size() - skip, length - copied);
+
+            std::memcpy(dest + copied, slice->data() + skip, n);
+            copied += n;
+            skip = 0;
+        }
+
+        return copied;
+    }
+
+
+    void PayloadChain::clear()
+    {
+        m_slices.clear();
+        m_size = 0;
+    }
+
+
+    PayloadPool::PayloadPool(const size_t blockSize, const size_t blocksPerSlab)
+    {
+        if (blockSize == 0 || blocksPerSlab == 0)
+            throw std::runtime_error("PayloadPool requires a block size and blocks per slab");
+
+        m_state = std::make_shared<State>(blockSize, blocksPerSlab);
+    }
+
+
+    PayloadSlice PayloadPool::allocate(const size_t size)
+    {
+        PayloadBlock* block = nullptr;
+
+        if (size <= m_state->blockSize)
+        {
+            block = m_state->take();
+            block->pool = m_state;
+        }
+        else
+        {
+            block = new (::operator new(sizeof(PayloadBlock) + size, BlockAlignment)) PayloadBlock();
+            ++m_state->oversized;
+        }
+
+        block->refs.store(1U, std::memory_order_relaxed);
+
+        return PayloadSlice(block, 0, size);
+    }
+
+
+    PayloadChain PayloadPool::allocateChain(const size_t size)
+    {
+        PayloadChain chain;
+
+        for (size_t remaining = size; remaining; )
+        {
+            const size_t n = std::min(remaining, m_state->blockSize);
+
+            chain.append(allocate(n));
+            remaining -= n;
+        }
+
+        return chain;
+    }
+
+
+    PayloadPool::Stats PayloadPool::stats() const
+    {
+        std::scoped_lock lock(m_state->mux);
+        return Stats{ m_state->slabs.size(), m_state->freeBlocks.size(), m_state->oversized.load() };
+    }
+
+
+    void PayloadPool::release(PayloadBlock* block)
+    {
+        if (!block->pool)
+        {
+            block->~PayloadBlock();
+            ::operator delete(block, BlockAlignment);
+            return;
+        }
+
+        // keeps the state alive while the block goes back, this may be the last reference to a destroyed pool
+        auto state = std::static_pointer_cast<State>(std::move(block->pool));
+        block->pool = nullptr;
+        state->recycle(block);
+    }
+
+
+    PayloadPool::State::~State()
+    {
+        for (auto slab : slabs)
+            ::operator delete(slab, BlockAlignment);
+    }
+
+
+    PayloadBlock* PayloadPool::State::take()
+    {
+        std::scoped_lock lock(mux);
+
+        if (freeBlocks.empty())
+        {
+            const size_t stride = blockStride(blockSize);
+            char* slab = static_cast<char*>(::operator new(stride * blocksPerSlab, BlockAlignment));
+
+            slabs.push_back(slab);
+
+            for (size_t i = blocksPerSlab; i-- > 0; )
+            {
+                freeBlocks.push_back(new (slab + i * stride) PayloadBlock());
+            }
+        }
+
+        PayloadBlock* block = freeBlocks.back();
+        freeBlocks.pop_back();
+        return block;
+    }
+
+
+    void PayloadPool::State::recycle(PayloadBlock* block)
+    {
+        std::scoped_lock lock(mux);
+        freeBlocks.push_back(block);
+    }
+}
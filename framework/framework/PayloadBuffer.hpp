@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace framework
+{
+    using std::shared_ptr;
+
+
+    class PayloadPool;
+
+
+    /// Header at the start of a payload block, followed by the block's bytes.
+    struct alignas(64) PayloadBlock
+    {
+        std::atomic_uint32_t refs;
+        shared_ptr<void> pool;      ///< PayloadPool state while in use, null for blocks which aren't pooled
+
+        char* bytes() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+
+    /// A refcounted view of part of a payload block. Copying a slice, or slicing it, shares the block rather
+    /// than copying its bytes, and the block is returned to its pool when the last slice of it is released.
+    ///
+    /// Slices of the same block share its bytes, so fill a block (i.e. from a socket read) before sharing it.
+    class PayloadSlice
+    {
+    public:
+        PayloadSlice() : m_block(nullptr), m_offset(0), m_size(0) {}
+
+        PayloadSlice(const PayloadSlice& other) : m_block(other.m_block), m_offset(other.m_offset), m_size(other.m_size)
+        {
+            if (m_block)
+                m_block->refs.fetch_add(1U, std::memory_order_relaxed);
+        }
+
+        PayloadSlice(PayloadSlice&& other) noexcept : m_block(other.m_block), m_offset(other.m_offset), m_size(other.m_size)
+        {
+            other.m_block = nullptr;
+            other.m_offset = other.m_size = 0;
+        }
+
+        PayloadSlice& operator=(PayloadSlice other) noexcept
+        {
+            std::swap(m_block, other.m_block);
+            std::swap(m_offset, other.m_offset);
+            std::swap(m_size, other.m_size);
+            return *this;
+        }
+
+        ~PayloadSlice()
+        {
+            release();
+        }
+
+
+        char* data() const { return m_block ? m_block->bytes() + m_offset : nullptr; }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        /// length bytes from offset, sharing this slice's block. Throws std::out_of_range if outside the slice.
+        PayloadSlice slice(const size_t offset, const size_t length) const;
+
+        /// Keeps the first size bytes, i.e. what a read actually filled.
+        void truncate(const size_t size);
+
+        /// Drops the first n bytes, i.e. what a write has sent.
+        void consume(const size_t n);
+
+    private:
+        friend class PayloadPool;
+
+        PayloadSlice(PayloadBlock* block, const size_t offset, const size_t size) : m_block(block), m_offset(offset), m_size(size)
+        {
+
+        }
+
+        void release();
+
+    private:
+        PayloadBlock* m_block;
+        size_t m_offset;
+        size_t m_size;
+    };
+
+
+    /// A payload as a sequence of slices, for scatter/gather: a message's header and body can come from
+    /// different blocks, and a large payload spans many, without being copied into one buffer.
+    class PayloadChain
+    {
+    public:
+        using const_iterator = std::vector<PayloadSlice>::const_iterator;
+
+
+        PayloadChain() : m_size(0) {}
+        PayloadChain(PayloadSlice slice) : m_size(0) { append(std::move(slice)); }
+
+        void append(PayloadSlice slice);
+        void append(const PayloadChain& chain);
+
+        /// length bytes from offset, sharing this chain's blocks. Throws std::out_of_range if outside the chain.
+        PayloadChain slice(const size_t offset, const size_t length) const;
+
+        /// Keeps the first size bytes.
+        void truncate(const size_t size);
+
+        /// Drops the first n bytes, i.e. after a partial write.
+        void consume(const size_t n);
+
+        /// Copies length bytes from offset to dest, for code which needs them contiguous. Returns the number copied.
+        size_t copyTo(char* dest, const size_t offset, const size_t length) const;
+
+        void clear();
+
+        /// Total bytes over the slices.
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+
+        size_t sliceCount() const { return m_slices.size(); }
+        const PayloadSlice& operator[](const size_t index) const { return m_slices[index]; }
+
+        const_iterator begin() const { return m_slices.begin(); }
+        const_iterator end() const { return m_slices.end(); }
+
+    private:
+        std::vector<PayloadSlice> m_slices;
+        size_t m_size;
+    };
+
+
+    /// Allocates payload blocks from slabs, each slab one allocation of blocksPerSlab blocks, and reuses
+    /// released blocks. Unlike vector<char>::resize(), the bytes aren't zero filled, and unlike
+    /// shared_ptr<vector<char>>, sharing a block doesn't allocate a control block.
+    ///
+    /// Requests larger than the block size get a block of their own, which isn't pooled.
+    /// The pool can be destroyed while its blocks are in use: the slabs are freed when the last is released.
+    ///
+    /// Usage:
+    ///    PayloadPool pool(64 * 1024);
+    ///    PayloadChain payload = pool.allocateChain(bytes);    // fill with a scatter read, see AsioBuffers.hpp
+    ///    PayloadChain body = payload.slice(headerSize, payload.size() - headerSize);
+    class PayloadPool
+    {
+    public:
+        struct Stats
+        {
+            size_t slabs;
+            size_t available;       ///< released blocks waiting for reuse
+            uint64_t oversized;     ///< allocations larger than the block size
+        };
+
+
+        PayloadPool(const size_t blockSize = 64U * 1024U, const size_t blocksPerSlab = 64U);
+
+        /// One slice of size bytes.
+        PayloadSlice allocate(const size_t size);
+
+        /// size bytes as a chain of pooled blocks.
+        PayloadChain allocateChain(const size_t size);
+
+        size_t blockSize() const { return m_state->blockSize; }
+        Stats stats() const;
+
+    private:
+        PayloadPool(const PayloadPool&) = delete;
+        PayloadPool& operator=(const PayloadPool&) = delete;
+
+
+        /// Shared by the pool and every block in use.
+        struct State
+        {
+            State(const size_t block, const size_t perSlab) : blockSize(block), blocksPerSlab(perSlab), oversized(0)
+            {
+
+            }
+
+            ~State();
+
+            PayloadBlock* take();
+            void recycle(PayloadBlock* block);
+
+            const size_t blockSize;
+            const size_t blocksPerSlab;
+            std::atomic_uint64_t oversized;
+
+            mutable std::mutex mux;
+            std::vector<PayloadBlock*> freeBlocks;
+            std::vector<void*> slabs;
+        };
+
+
+        friend class PayloadSlice;
+
+        static void release(PayloadBlock* block);
+
+    private:
+        shared_ptr<State> m_state;
+    };
+}
@@ -1,96 +1,755 @@
-#include "Pipeline.hpp"
-
-
-namespace framework
-{
-    Pipeline::Pipeline(const string& name) : m_name(name), m_nextStageId(1)
-    {
-        m_nc = std::make_shared<Poco::NotificationCenter>();
-    }
-
-
-    Pipeline::~Pipeline()
-    {
-        stop(true);
-    }
-
-
-    bool Pipeline::initialise()
-    {
-      if (!m_stages.empty())
-      {
-        m_stagePool = std::make_unique<ctpl::thread_pool>(static_cast<int>(m_stages.size()));
-
-        for (auto& stage : m_stages)
-        {
-          // initialise, pass the notification center so everything uses the same notification center,
-          // allowing communication between pipeline and stages.
-          stage.second->initialise(stage.first, m_nc);
-        }
-      }
-
-      return m_stagePool && !m_stages.empty();
-    }
-
-
-    void Pipeline::start()
-    {
-        for (auto& stage : m_stages)
-        {
-            // store the future of the stage worker for when we stop()
-            // after this call, the stage::run() is executing in one of the pool's threads
-            m_stageFutures[stage.first] = m_stagePool->push(StageWorker{ stage.second }).share();
-        }
-    }
-
-
-    void Pipeline::stop(const bool waitForStages)
-    {
-        logg(m_name + ": waiting for stages to stop");
-
-        if (m_stagePool)
-        {
-            m_stagePool->clear_queue();
-        }        
-
-        for (auto& stage : m_stages)
-        {
-            stage.second->stopStage();
-        }
-
-        if (waitForStages)
-        {
-            for (auto& stageFutures : m_stageFutures)
-            {
-                if (stageFutures.second.valid())
-                    stageFutures.second.wait();
-            }
-        }
-        
-
-        if (m_stagePool)
-        {
-            m_stagePool->stop(waitForStages);
-        }        
-
-        m_nextStageId = 1;
-    }
-
-
-    void Pipeline::addStage(shared_ptr<PipelineStage> stage)
-    {
-        m_stages.insert(std::make_pair(m_nextStageId.load(), stage));
-
-        ++m_nextStageId;
-    }
-
-
-    void Pipeline::injectData(const shared_ptr<StageData>& data)
-    {
-        if (!m_stages.empty())
-        {
-            m_stages.begin()->second->injectData(data);
-        }
-    }
-}
-
+#include "Pipeline.hpp"
+
+#include <sstream>
+#include <algorithm>
+#include <tuple>
+
+
+namespace framework
+{
+    /// CPU order in which stage instances are placed.
+    static vector<int> placementOrder(const Pipeline::Placement placement, const vector<int>& explicitCpus)
+    {
+        if (placement == Pipeline::Placement::Explicit)
+            return explicitCpus;
+
+        vector<CpuInfo> cpus = cpuTopology();
+
+        // siblings next to each other, cores of a socket together
+        std::sort(cpus.begin(), cpus.end(), [](const CpuInfo& a, const CpuInfo& b) 
+        {
+            return std::tie(a.node, a.package, a.core, a.cpu) < std::tie(b.node, b.package, b.core, b.cpu);
+        });
+
+        vector<int> order;
+
+        if (placement == Pipeline::Placement::Pack)
+        {
+            for (auto& cpu : cpus)
+                order.push_back(cpu.cpu);
+        }
+        else if (placement == Pipeline::Placement::Spread)
+        {
+            // per node, the first hyperthread of each core, then the second, ...
+            map<int, vector<int>> nodes;
+            size_t assigned = 0;
+
+            for (size_t sibling = 0; assigned < cpus.size(); ++sibling)
+            {
+                for (size_t core = 0; core < cpus.size(); )
+                {
+                    size_t end = core;
+
+                    while (end < cpus.size() && std::tie(cpus[end].node, cpus[end].package, cpus[end].core) == std::tie(cpus[core].node, cpus[core].package, cpus[core].core))
+                        ++end;
+
+                    if (core + sibling < end)
+                    {
+                        nodes[cpus[core].node].push_back(cpus[core + sibling].cpu);
+                        ++assigned;
+                    }
+
+                    core = end;
+                }
+            }
+
+            // then alternate between the nodes
+            for (size_t i = 0; order.size() < cpus.size(); ++i)
+            {
+                for (auto& node : nodes)
+                {
+                    if (i < node.second.size())
+                        order.push_back(node.second[i]);
+                }
+            }
+        }
+
+        return order;
+    }
+
+
+    Pipeline::Pipeline(const string& name) : m_name(name), m_nextStageId(1), m_placement(Placement::Os), m_scalingInterval(100)
+    {
+        m_nc = std::make_shared<Poco::NotificationCenter>();
+    }
+
+
+    Pipeline::~Pipeline()
+    {
+        stop(true);
+    }
+
+
+    bool Pipeline::initialise()
+    {
+      if (!m_stages.empty())
+      {
+        size_t nWorkers = 0;
+
+        for (auto& stage : m_stages)
+        {
+          // replicas share one input, which only one suspended coroutine at a time can wait on
+          if (!stage.second.front()->needsThread() && !m_shardKeys.count(stage.first) && (stage.second.size() > 1U || m_scaled.count(stage.first)))
+          {
+            logg(m_name + ": coroutine stage " + stage.second.front()->name() + " can't be replicated");
+            return false;
+          }
+
+          for (auto& worker : stage.second)
+          {
+            // initialise, pass the notification center so everything uses the same notification center,
+            // allowing communication between pipeline and stages.
+            worker->initialise(stage.first, m_nc);
+
+            if (m_executor)
+              worker->setExecutor(m_executor);
+
+            if (m_budget)
+              worker->setMemoryBudget(m_budget);
+
+            if (worker->needsThread() && !m_fused.count(stage.first))
+              ++nWorkers;
+          }
+        }
+
+        if (!m_executor)
+          m_stagePool = std::make_unique<ctpl::thread_pool>(static_cast<int>(nWorkers));
+
+        size_t nInstances = 0;
+
+        for (auto& stage : m_stages)
+          nInstances += stage.second.size();
+
+        m_workerCpus.assign(nInstances, -1);
+
+        if (const vector<int> cpus = placementOrder(m_placement, m_placementCpus); !cpus.empty())
+        {
+          size_t worker = 0;
+
+          for (auto& stage : m_stages)
+          {
+            for (size_t instance = 0; instance < stage.second.size(); ++instance, ++worker)
+            {
+              m_workerCpus[worker] = cpus[worker % cpus.size()];
+
+              // replicas share the first instance's buffer
+              if (instance == 0 || m_shardKeys.count(stage.first))
+              {
+                // first touch from the stage's cpu, so the buffer is on its node
+                ScopedAffinity affinity(m_workerCpus[worker]);
+
+                if (affinity.pinned())
+                  stage.second[instance]->localiseBuffer();
+              }
+            }
+          }
+        }
+
+        if (m_connections.empty())
+        {
+          for (auto stage = m_stages.begin(), next = std::next(stage); next != m_stages.end(); ++stage, ++next)
+          {
+            m_connections.emplace(stage->first, next->first);
+          }
+        }
+
+        map<StageId, size_t> producers;
+
+        // data goes straight from a stage to the next stage's buffer, rather than via the notification center
+        for (auto& connection : m_connections)
+        {
+          auto& source = m_stages[connection.first];
+          auto& targets = m_stages[connection.second];
+          auto& target = targets.front();
+          const bool ordered = m_orderedStages.count(connection.first) > 0;
+
+          // replicas of an ordered stage output via one ReorderBuffer
+          producers[connection.second] += ordered ? 1U : source.size();
+
+          if (producers[connection.second] > 1U && !target->acceptsMultipleProducers())
+          {
+            logg(m_name + ": stage " + target->name() + " has multiple inputs but its buffer is single producer");
+            return false;
+          }
+
+          if (auto fused = m_fused.find(connection.second); fused != m_fused.end())
+          {
+            if (fused->second != connection.first || producers[connection.second] > 1U)
+            {
+              logg(m_name + ": fused stage " + target->name() + " must have one input, the stage it's fused with");
+              return false;
+            }
+
+            source.front()->connectFused(*target, ordered);
+          }
+          else if (auto shardKey = m_shardKeys.find(connection.second); shardKey != m_shardKeys.end())
+          {
+            source.front()->connect(targets, shardKey->second, ordered);
+          }
+          else
+          {
+            source.front()->connect(*target, ordered);
+          }
+        }
+
+        for (auto& [to, from] : m_fused)
+        {
+          if (!producers.count(to))
+          {
+            logg(m_name + ": fused stage " + m_stages[to].front()->name() + " isn't connected to the stage it's fused with");
+            return false;
+          }
+        }
+
+        // replicas and shards send to the same outputs as the first instance of their stage
+        for (auto& stage : m_stages)
+        {
+          for (size_t replica = 1; replica < stage.second.size(); ++replica)
+          {
+            stage.second[replica]->shareOutputs(*stage.second.front());
+          }
+        }
+      }
+
+      return (m_stagePool || m_executor) && !m_stages.empty();
+    }
+
+
+    void Pipeline::start()
+    {
+        if (m_budget)
+            m_budget->open();
+
+        size_t index = 0;
+
+        for (auto& stage : m_stages)
+        {
+            for (auto& worker : stage.second)
+            {
+                const int cpu = index < m_workerCpus.size() ? m_workerCpus[index] : -1;
+                ++index;
+
+                // runs on the thread of the stage it's fused with
+                if (m_fused.count(stage.first))
+                    continue;
+
+                if (!worker->needsThread())
+                {
+                    m_stageFutures.push_back(worker->startDetached());
+                    continue;
+                }
+
+                if (m_executor)
+                {
+                    m_stageFutures.push_back(m_executor->runBlocking([stageWorker = StageWorker{ worker, cpu }] { stageWorker(0); }));
+                    continue;
+                }
+
+                // store the future of the stage worker for when we stop()
+                // after this call, the stage::run() is executing in one of the pool's threads
+                m_stageFutures.push_back(m_stagePool->push(StageWorker{ worker, cpu }).share());
+            }
+        }
+
+        if (!m_scaled.empty())
+        {
+            m_scalingTimer.start([this] { scale(); }, m_scalingInterval);
+        }
+    }
+
+
+    void Pipeline::stop(const bool waitForStages)
+    {
+        logg(m_name + ": waiting for stages to stop");
+
+        // no replicas are added or removed from here
+        m_scalingTimer.stop();
+
+        // producers waiting for the budget would wait for stages which are stopping
+        if (m_budget)
+            m_budget->close();
+
+        if (m_stagePool)
+        {
+            m_stagePool->clear_queue();
+        }        
+
+        for (auto& stage : m_stages)
+        {
+            for (auto& worker : stage.second)
+            {
+                worker->stopStage();
+            }
+        }
+
+        vector<shared_future<void>> scaledFutures;
+
+        {
+            std::scoped_lock lock(m_scalingMux);
+
+            for (auto& [id, scaled] : m_scaled)
+            {
+                for (auto& replica : scaled.added)
+                    replica->stopStage();
+
+                for (auto& retired : scaled.retiring)
+                    scaledFutures.push_back(retired.second);
+
+                scaledFutures.insert(scaledFutures.end(), scaled.addedFutures.begin(), scaled.addedFutures.end());
+
+                scaled.added.clear();
+                scaled.addedFutures.clear();
+                scaled.retiring.clear();
+                scaled.lastBusy.clear();
+                scaled.quietIntervals = 0;
+            }
+        }
+
+        if (waitForStages)
+        {
+            for (auto& stageFuture : m_stageFutures)
+            {
+                if (stageFuture.valid())
+                    stageFuture.wait();
+            }
+
+            for (auto& stageFuture : scaledFutures)
+            {
+                if (stageFuture.valid())
+                    stageFuture.wait();
+            }
+        }
+        
+
+        if (m_stagePool)
+        {
+            m_stagePool->stop(waitForStages);
+        }        
+
+        m_stageFutures.clear();
+        m_nextStageId = 1;
+    }
+
+
+    StageId Pipeline::addStage(shared_ptr<PipelineStage> stage)
+    {
+        const StageId id = m_nextStageId++;
+
+        m_stages[id].push_back(stage);
+
+        return id;
+    }
+
+
+    StageId Pipeline::addStage(StageFactory factory, const size_t replicas, const bool ordered)
+    {
+        auto primary = factory();
+
+        if (replicas > 1U && !primary->acceptsMultipleConsumers())
+            throw std::runtime_error("Replicated stage " + primary->name() + " requires a multi consumer buffer");
+
+        if (ordered && primary->mayDropData())
+            throw std::runtime_error("Ordered stage " + primary->name() + " requires a buffer which doesn't drop data");
+
+        if (ordered)
+        {
+            primary->sequenceInput();
+            m_orderedStages.insert(m_nextStageId.load());
+        }
+
+        const StageId id = addStage(primary);
+
+        for (size_t replica = 1; replica < replicas; ++replica)
+        {
+            auto stage = factory();
+            stage->shareInput(*primary);
+            m_stages[id].push_back(stage);
+        }
+
+        return id;
+    }
+
+
+    StageId Pipeline::addAutoscaledStage(StageFactory factory, const ScalingPolicy& policy, const bool ordered)
+    {
+        if (policy.minReplicas == 0 || policy.maxReplicas < policy.minReplicas)
+            throw std::runtime_error(m_name + ": autoscaled stage requires 0 < minReplicas <= maxReplicas");
+
+        const StageId id = addStage(factory, policy.minReplicas, ordered);
+
+        // addStage() only checks when it replicates
+        if (policy.maxReplicas > 1U && !m_stages[id].front()->acceptsMultipleConsumers())
+            throw std::runtime_error("Replicated stage " + m_stages[id].front()->name() + " requires a multi consumer buffer");
+
+        std::scoped_lock lock(m_scalingMux);
+
+        m_scaled[id].factory = std::move(factory);
+        m_scaled[id].policy = policy;
+
+        return id;
+    }
+
+
+    size_t Pipeline::instanceCount(const StageId id) const
+    {
+        return instances(id).size();
+    }
+
+
+    vector<shared_ptr<PipelineStage>> Pipeline::instances(const StageId id) const
+    {
+        vector<shared_ptr<PipelineStage>> stages;
+
+        if (auto stage = m_stages.find(id); stage != m_stages.end())
+            stages = stage->second;
+
+        std::scoped_lock lock(m_scalingMux);
+
+        if (auto scaled = m_scaled.find(id); scaled != m_scaled.end())
+            stages.insert(stages.end(), scaled->second.added.begin(), scaled->second.added.end());
+
+        return stages;
+    }
+
+
+    void Pipeline::scale()
+    {
+        std::scoped_lock lock(m_scalingMux);
+
+        const double interval = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(m_scalingInterval).count());
+
+        for (auto& [id, scaled] : m_scaled)
+        {
+            const auto& primary = m_stages[id].front();
+            const size_t depth = primary->queueSize();
+
+            // how busy the current instances were over the interval, new instances have no previous busy time
+            std::chrono::nanoseconds busy{ 0 };
+            size_t count = 0;
+            map<const PipelineStage*, std::chrono::nanoseconds> lastBusy;
+
+            auto measure = [&](const shared_ptr<PipelineStage>& stage)
+            {
+                const std::chrono::nanoseconds total = stage->metrics().busyTime;
+
+                if (auto last = scaled.lastBusy.find(stage.get()); last != scaled.lastBusy.end())
+                {
+                    busy += total - last->second;
+                    ++count;
+                }
+
+                lastBusy[stage.get()] = total;
+            };
+
+            for (auto& stage : m_stages[id])
+                measure(stage);
+
+            for (auto& stage : scaled.added)
+                measure(stage);
+
+            scaled.lastBusy = std::move(lastBusy);
+
+            const double utilisation = count ? static_cast<double>(busy.count()) / (interval * static_cast<double>(count)) : 0.0;
+            const size_t replicas = m_stages[id].size() + scaled.added.size();
+
+            if ((depth >= scaled.policy.scaleUpDepth || (depth > 0 && utilisation >= scaled.policy.scaleUpBusy)) && replicas < scaled.policy.maxReplicas)
+            {
+                scaled.quietIntervals = 0;
+                addReplica(id, scaled);
+            }
+            else if (depth == 0 && utilisation < scaled.policy.scaleDownBusy)
+            {
+                if (++scaled.quietIntervals >= scaled.policy.scaleDownIntervals && !scaled.added.empty())
+                {
+                    scaled.quietIntervals = 0;
+                    removeReplica(scaled);
+                }
+            }
+            else
+            {
+                scaled.quietIntervals = 0;
+            }
+
+            // retired replicas which have finished their last item
+            auto finished = std::remove_if(scaled.retiring.begin(), scaled.retiring.end(), [](const auto& retired) 
+            {
+                return retired.second.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            });
+
+            for (auto retired = finished; retired != scaled.retiring.end(); ++retired)
+            {
+                // its thread is idle, give it back
+                if (m_stagePool && retired->first->needsThread() && m_stagePool->n_idle() > 0)
+                    m_stagePool->resize(m_stagePool->size() - 1);
+            }
+
+            scaled.retiring.erase(finished, scaled.retiring.end());
+        }
+    }
+
+
+    void Pipeline::addReplica(const StageId id, ScaledStage& scaled)
+    {
+        const auto& primary = m_stages[id].front();
+        auto replica = scaled.factory();
+
+        replica->shareInput(*primary);
+        replica->initialise(id, m_nc);
+        replica->shareOutputs(*primary);
+
+        if (m_executor)
+            replica->setExecutor(m_executor);
+
+        if (m_budget)
+            replica->setMemoryBudget(m_budget);
+
+        shared_future<void> future;
+
+        if (!replica->needsThread())
+        {
+            future = replica->startDetached();
+        }
+        else if (m_executor)
+        {
+            future = m_executor->runBlocking([stageWorker = StageWorker{ replica }] { stageWorker(0); });
+        }
+        else
+        {
+            // the pool has a thread per running stage, so grow it unless a retired replica's thread is free
+            if (m_stagePool->n_idle() == 0)
+                m_stagePool->resize(m_stagePool->size() + 1);
+
+            future = m_stagePool->push(StageWorker{ replica }).share();
+        }
+
+        scaled.added.push_back(replica);
+        scaled.addedFutures.push_back(future);
+
+        std::ostringstream ss;
+        ss << m_name << ": stage " << id << " (" << primary->name() << ") scaled up to " << m_stages[id].size() + scaled.added.size() << " replicas";
+        logg(ss.str());
+    }
+
+
+    void Pipeline::removeReplica(ScaledStage& scaled)
+    {
+        auto replica = scaled.added.back();
+
+        // the input is shared, so only this replica stops, after the item it's processing
+        replica->stopInstance();
+
+        scaled.retiring.emplace_back(replica, scaled.addedFutures.back());
+        scaled.added.pop_back();
+        scaled.addedFutures.pop_back();
+
+        std::ostringstream ss;
+        ss << m_name << ": stage " << replica->id() << " (" << replica->name() << ") scaled down, " << scaled.added.size() << " added replicas remain";
+        logg(ss.str());
+    }
+
+
+    StageId Pipeline::addShardedStage(StageFactory factory, const size_t nShards, PipelineStage::KeyExtractor key)
+    {
+        const StageId id = addStage(factory());
+
+        for (size_t shard = 1; shard < nShards; ++shard)
+        {
+            m_stages[id].push_back(factory());
+        }
+
+        m_shardKeys[id] = std::move(key);
+
+        return id;
+    }
+
+
+    void Pipeline::setPlacement(const Placement placement, const vector<int>& cpus)
+    {
+        m_placement = placement;
+        m_placementCpus = cpus;
+    }
+
+
+    bool Pipeline::connect(const StageId from, const StageId to)
+    {
+        if (m_stages.count(from) && m_stages.count(to))
+        {
+            m_connections.emplace(from, to);
+            return true;
+        }
+
+        return false;
+    }
+
+
+    bool Pipeline::fuse(const StageId from, const StageId to)
+    {
+        if (!m_stages.count(from) || from == to)
+            return false;
+
+        if (auto stage = m_stages.find(to); stage != m_stages.end() && stage->second.size() == 1U && stage->second.front()->fusable() && 
+            !m_shardKeys.count(to) && !m_scaled.count(to))
+        {
+            m_fused[to] = from;
+            return true;
+        }
+
+        return false;
+    }
+
+
+    bool Pipeline::setRouter(const StageId from, PipelineStage::Router router)
+    {
+        if (auto stage = m_stages.find(from); stage != m_stages.end() && !m_orderedStages.count(from))
+        {
+            for (auto& worker : stage->second)
+            {
+                worker->setRouter(router);
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+
+    BufferResult Pipeline::injectData(const shared_ptr<StageData>& data)
+    {
+        if (!m_stages.empty())
+        {
+            return injectData(data, m_stages.begin()->first);
+        }
+
+        return BufferResult::Rejected;
+    }
+
+
+    BufferResult Pipeline::injectData(const shared_ptr<StageData>& data, const StageId stageId)
+    {
+        // consumers take null as no data
+        if (!data)
+            return BufferResult::Rejected;
+
+        if (auto stage = m_stages.find(stageId); stage != m_stages.end())
+        {
+            // only called by the stage it's fused with
+            if (m_fused.count(stageId))
+                return BufferResult::Rejected;
+
+            if (m_recorder)
+                m_recorder->record(*data, stageId);
+
+            if (auto shardKey = m_shardKeys.find(stageId); shardKey != m_shardKeys.end())
+            {
+                const size_t shard = PipelineStage::shardFor(shardKey->second(*data), stage->second.size());
+                return stage->second[shard]->injectData(data);
+            }
+
+            return stage->second.front()->injectData(data);
+        }
+
+        return BufferResult::Rejected;
+    }
+
+
+    map<StageId, StageMetrics> Pipeline::metrics() const
+    {
+        map<StageId, StageMetrics> metrics;
+
+        for (const auto& [id, primaries] : m_stages)
+        {
+            StageMetrics& total = metrics[id];
+            const bool sharded = m_shardKeys.count(id) != 0;
+
+            for (const auto& stage : instances(id))
+            {
+                const StageMetrics m = stage->metrics();
+
+                total.itemsIn += m.itemsIn;
+                total.itemsOut += m.itemsOut;
+                total.waitTime += m.waitTime;
+                total.busyTime += m.busyTime;
+                total.forwardTime += m.forwardTime;
+                total.peakQueueDepth = std::max(total.peakQueueDepth, m.peakQueueDepth);
+
+                if (sharded)
+                    total.queueDepth += m.queueDepth;
+            }
+
+            total.name = primaries.front()->name();
+
+            if (!sharded)
+                total.queueDepth = primaries.front()->queueSize();
+        }
+
+        return metrics;
+    }
+
+
+    map<StageId, LatencySnapshot> Pipeline::stageLatency() const
+    {
+        map<StageId, LatencySnapshot> latency;
+
+        for (const auto& [id, primaries] : m_stages)
+        {
+            for (const auto& stage : instances(id))
+                latency[id].merge(stage->dwellLatency());
+        }
+
+        return latency;
+    }
+
+
+    LatencySnapshot Pipeline::pipelineLatency() const
+    {
+        LatencySnapshot latency;
+
+        for (const auto& [id, primaries] : m_stages)
+        {
+            for (const auto& stage : instances(id))
+            {
+                if (!stage->hasOutputs())
+                    latency.merge(stage->endToEndLatency());
+            }
+        }
+
+        return latency;
+    }
+
+
+    void Pipeline::logMetrics() const
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+
+        using std::chrono::microseconds;
+
+        const auto latency = stageLatency();
+
+        for (const auto& [id, m] : metrics())
+        {
+            const LatencySnapshot& dwell = latency.at(id);
+            std::ostringstream ss;
+
+            ss  << m_name << ": stage " << id << " (" << m.name << ") in " << m.itemsIn << ", out " << m.itemsOut 
+                << ", queue " << m.queueDepth << " (peak " << m.peakQueueDepth << ")"
+                << ", wait " << duration_cast<milliseconds>(m.waitTime).count() << "ms"
+                << ", busy " << duration_cast<milliseconds>(m.busyTime).count() << "ms"
+                << ", forward " << duration_cast<milliseconds>(m.forwardTime).count() << "ms"
+                << ", dwell p50/p99/p999/max " << duration_cast<microseconds>(dwell.p50()).count() << "/" << duration_cast<microseconds>(dwell.p99()).count() 
+                << "/" << duration_cast<microseconds>(dwell.p999()).count() << "/" << duration_cast<microseconds>(dwell.max()).count() << "us";
+
+            logg(ss.str());
+        }
+
+        const LatencySnapshot total = pipelineLatency();
+        std::ostringstream ss;
+
+        ss  << m_name << ": latency p50/p99/p999/max " << duration_cast<microseconds>(total.p50()).count() << "/" << duration_cast<microseconds>(total.p99()).count()
+            << "/" << duration_cast<microseconds>(total.p999()).count() << "/" << duration_cast<microseconds>(total.max()).count() << "us over " << total.count() << " items";
+
+        logg(ss.str());
+    }
+}
+
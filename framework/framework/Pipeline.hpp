@@ -1,74 +1,254 @@
-#pragma once
-
-#ifdef WIN32
-#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
-#endif
-
-
-#include <functional>
-#include <future>
-#include <string>
-#include <map>
-#include <atomic>
-
-#include "ctpl_threadpool.hpp"
-#include "PipelineStage.hpp"
-#include "Logger.hpp"
-
-
-namespace framework
-{
-    using std::shared_ptr;
-    using std::unique_ptr;
-    using std::string;
-    using std::map;
-    using std::shared_future;
-
-
-    class Pipeline
-    {
-        struct StageWorker
-        {
-            StageWorker(const shared_ptr<PipelineStage>& stg) : stage(stg)
-            {
-
-            }
-
-            void operator()(int threadId) const
-            {
-                stage->run();
-            }
-
-            shared_ptr<PipelineStage> stage;
-        };
-
-
-    public:
-        Pipeline(const string& name = "");
-        ~Pipeline();
-
-        virtual void start();
-        virtual void stop(const bool waitForStages = true);
-
-        virtual bool initialise();
-
-        virtual void addStage(shared_ptr<PipelineStage> stage);
-
-        void injectData(const shared_ptr<StageData>& data);
-
-        string name() const { return m_name; }
-
-
-    protected:
-        shared_ptr<Poco::NotificationCenter> notificationCenter() { return m_nc; }
-
-    private:
-        std::atomic<StageId> m_nextStageId;
-        string m_name; 
-        unique_ptr<ctpl::thread_pool> m_stagePool;
-        map<StageId, shared_ptr<PipelineStage>> m_stages;
-        map<StageId, shared_future<void>> m_stageFutures;
-        shared_ptr<Poco::NotificationCenter> m_nc;
-    };
-}
-
+#pragma once
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
+
+
+#include <functional>
+#include <future>
+#include <string>
+#include <map>
+#include <set>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+#include "ctpl_threadpool.hpp"
+#include "PipelineStage.hpp"
+#include "Logger.hpp"
+#include "CpuAffinity.hpp"
+#include "Executor.hpp"
+#include "IntervalTimer.hpp"
+#include "InjectLog.hpp"
+
+
+namespace framework
+{
+    using std::shared_ptr;
+    using std::unique_ptr;
+    using std::string;
+    using std::map;
+    using std::vector;
+    using std::shared_future;
+
+
+    class Pipeline
+    {
+        struct StageWorker
+        {
+            StageWorker(const shared_ptr<PipelineStage>& stg, const int cpuId = -1) : stage(stg), cpu(cpuId)
+            {
+
+            }
+
+            void operator()(int threadId) const
+            {
+                // restored after, the thread may be reused by other stages
+                std::unique_ptr<ScopedAffinity> affinity;
+
+                if (cpu >= 0)
+                {
+                    affinity = std::make_unique<ScopedAffinity>(cpu);
+
+                    if (!affinity->pinned())
+                        logg(stage->name() + ": failed to pin to cpu " + std::to_string(cpu));
+                }
+
+                stage->initialiseThread();
+                stage->run();
+
+                // an ordered stage's last inputs, the next stage waits for them
+                stage->completeInputs();
+            }
+
+            shared_ptr<PipelineStage> stage;
+            int cpu;    ///< -1 to leave placement to the OS
+        };
+
+
+    public:
+        using StageFactory = std::function<shared_ptr<PipelineStage>()>;
+
+        /// When an autoscaled stage's replicas are added and removed, see addAutoscaledStage().
+        struct ScalingPolicy
+        {
+            size_t minReplicas = 1;
+            size_t maxReplicas = 4;
+            size_t scaleUpDepth = 64;           ///< add a replica when the input buffer holds at least this many items
+            double scaleUpBusy = 0.9;           ///< or has a backlog while the replicas were busy at least this fraction of the interval
+            double scaleDownBusy = 0.5;         ///< remove a replica when busy less than this with an empty input buffer ...
+            unsigned scaleDownIntervals = 10;   ///< ... for this many intervals in a row, so a pause in a burst doesn't remove one
+        };
+
+
+        /// Where stage threads run. Stage instances are placed in stage id order, replicas and shards in turn.
+        enum class Placement 
+        { 
+            Os,         ///< not pinned, the OS places threads
+            Explicit,   ///< instance i is pinned to cpus[i], wrapping if there are more instances than cpus
+            Pack,       ///< adjacent stages on sibling hyperthreads, then neighbouring cores of the same socket, so handoffs stay in cache
+            Spread      ///< one stage per physical core, alternating between NUMA nodes, before using hyperthread siblings
+        };
+
+
+        Pipeline(const string& name = "");
+        ~Pipeline();
+
+        virtual void start();
+        virtual void stop(const bool waitForStages = true);
+
+        virtual bool initialise();
+
+        /// Returns the new stage's id. Stage ids are allocated in the order stages are added, starting at 1.
+        virtual StageId addStage(shared_ptr<PipelineStage> stage);
+
+        /// Adds a stage with replicas instances, created by factory, each running on its own thread and
+        /// taking data from one shared input buffer, so the stage can't use a PipelineStage::BufferType::RingBuffer. 
+        ///
+        /// If ordered, data leaves the stage in the order it arrived. This requires that the stage doesn't drop data 
+        /// (OverflowPolicy::Block) and has no router. A replica may pass on any number of items for each item it 
+        /// takes, new objects included: what it passes on between taking an item and asking for more goes in that 
+        /// item's place.
+        ///
+        /// Throws std::runtime_error if the stage's buffer doesn't support this. initialise() fails for replicated
+        /// CoroutineStages, which would poll the shared input rather than wait on it.
+        StageId addStage(StageFactory factory, const size_t replicas, const bool ordered = false);
+
+        /// Adds a replicated stage whose number of replicas is adjusted while the pipeline runs, between the policy's
+        /// min and max, from its input buffer's depth and how busy the replicas are. Replicas are added by factory and
+        /// removed by stopping them without closing the shared input. Requirements are as the replicated addStage().
+        StageId addAutoscaledStage(StageFactory factory, const ScalingPolicy& policy, const bool ordered = false);
+
+        /// How often autoscaled stages are checked, 100ms by default. Set before start().
+        void setScalingInterval(const std::chrono::milliseconds interval) { m_scalingInterval = interval; }
+
+        /// Number of instances of a stage currently running, including replicas added by autoscaling.
+        size_t instanceCount(const StageId id) const;
+
+        /// Adds a stage with nShards instances, created by factory, each with its own input buffer and thread. 
+        /// Data sent to the stage goes to the shard chosen by hashing key(data), so data with the same key
+        /// is always processed by the same shard, in the order it was sent.
+        StageId addShardedStage(StageFactory factory, const size_t nShards, PipelineStage::KeyExtractor key);
+
+        /// Runs the stages on executor, which can be shared by many pipelines, rather than on a thread pool 
+        /// of the pipeline's own. PipelineStages each have one of the executor's blocking threads,
+        /// CoroutineStages which weren't given an executor run on its workers. Set before initialise().
+        void setExecutor(shared_ptr<Executor> executor) { m_executor = std::move(executor); }
+
+        /// Set before initialise(). Pinned stages' buffers are allocated on their NUMA node when the pipeline is 
+        /// initialised and PipelineStage::initialiseThread() is called on the pinned thread.
+        void setPlacement(const Placement placement, const vector<int>& cpus = {});
+
+        /// Caps the bytes of data, by StageData::byteSize(), queued in the pipeline's stage buffers, since per buffer item 
+        /// limits don't bound memory when item sizes vary widely. Data entering the pipeline, by injectData() or from a
+        /// source stage's dataComplete(), waits while the budget is used up if block, otherwise it's rejected. 
+        /// Data already in the pipeline is always let through, so a full budget can't stall the stages which would free it.
+        /// Set before initialise().
+        void setMemoryBudget(const size_t bytes, const bool block = true) { m_budget = std::make_shared<MemoryBudget>(bytes, block); }
+
+        /// Logs every item passed to injectData(), for InjectReplayer to reproduce the load. Not synchronised with
+        /// injectData(), so set it before start(), or while the pipeline is stopped; nullptr stops recording.
+        void setRecorder(shared_ptr<InjectRecorder> recorder) { m_recorder = std::move(recorder); }
+
+        /// Bytes counted against the memory budget, 0 without one.
+        size_t bytesInFlight() const { return m_budget ? m_budget->used() : 0U; }
+
+        /// Sends the output of stage 'from' to stage 'to'. A stage can have multiple outputs (fan-out) and
+        /// multiple stages can output to the same stage (fan-in), which can't use a PipelineStage::BufferType::RingBuffer.
+        ///
+        /// If connect() is never called, each stage outputs to the stage added after it.
+        /// Returns false if either stage doesn't exist.
+        bool connect(const StageId from, const StageId to);
+
+        /// Runs stage 'to' on the thread of stage 'from', its only input: from's dataComplete() calls to's process() 
+        /// directly instead of adding to its buffer, so the hop costs a function call rather than a queue push and 
+        /// a wakeup. 'to' has no thread of its own. Stages stay separate classes, 'to' must be fusable(), 
+        /// i.e. a TransformStage, with one instance, and data can't be injected into it.
+        ///
+        /// Chains of cheap stages can be fused pairwise. Returns false if either stage doesn't exist or 'to' can't 
+        /// be fused. initialise() fails if 'from' isn't connected to 'to' or 'to' has other inputs.
+        bool fuse(const StageId from, const StageId to);
+
+        /// With multiple outputs, 'from' sends to all of them unless it has a router to choose one per item. 
+        /// The router returns an index into the outputs, in the order they were connected.
+        /// Returns false if the stage doesn't exist or is an ordered, replicated stage.
+        bool setRouter(const StageId from, PipelineStage::Router router);
+
+        /// Adds data to the first stage. Blocks while the first stage's buffer is full if it 
+        /// uses PipelineStage::OverflowPolicy::Block.
+        BufferResult injectData(const shared_ptr<StageData>& data);
+
+        /// Adds data to a particular stage, i.e. in a pipeline with multiple input stages. Null data is rejected.
+        BufferResult injectData(const shared_ptr<StageData>& data, const StageId stageId);
+
+        /// Snapshot of every stage's metrics, by stage id. Can be called while the pipeline runs.
+        ///
+        /// For replicated and sharded stages the counters and times are summed over the instances. 
+        /// queueDepth is the shared buffer's depth for replicas and the total over the shards for a sharded stage. 
+        /// peakQueueDepth is the highest peak of any one instance. Replicas removed by autoscaling are no longer counted.
+        map<StageId, StageMetrics> metrics() const;
+
+        /// Per stage, how long data waited in the stage's input buffer, merged over replicas and shards.
+        map<StageId, LatencySnapshot> stageLatency() const;
+
+        /// How long data took from entering the pipeline, by injectData() or from a source stage, until 
+        /// a stage with no outputs took it.
+        LatencySnapshot pipelineLatency() const;
+
+        /// Logs a line per stage with its metrics and latency.
+        void logMetrics() const;
+
+        string name() const { return m_name; }
+
+
+    protected:
+        shared_ptr<Poco::NotificationCenter> notificationCenter() { return m_nc; }
+
+    private:
+        /// Replicas added to an autoscaled stage, beyond those in m_stages.
+        struct ScaledStage
+        {
+            StageFactory factory;
+            ScalingPolicy policy;
+            vector<shared_ptr<PipelineStage>> added;
+            vector<shared_future<void>> addedFutures;
+            vector<std::pair<shared_ptr<PipelineStage>, shared_future<void>>> retiring;   ///< stopped, run() may not have returned
+            map<const PipelineStage*, std::chrono::nanoseconds> lastBusy;
+            unsigned quietIntervals = 0;
+        };
+
+
+        /// The stage's instances, m_stages and any added by scaling.
+        vector<shared_ptr<PipelineStage>> instances(const StageId id) const;
+
+        void scale();
+        void addReplica(const StageId id, ScaledStage& scaled);
+        void removeReplica(ScaledStage& scaled);
+
+
+    private:
+        std::atomic<StageId> m_nextStageId;
+        string m_name; 
+        unique_ptr<ctpl::thread_pool> m_stagePool;
+        shared_ptr<Executor> m_executor;    ///< if set, used instead of m_stagePool
+        shared_ptr<MemoryBudget> m_budget;
+        shared_ptr<InjectRecorder> m_recorder;
+        map<StageId, vector<shared_ptr<PipelineStage>>> m_stages;   ///< replicas share the first's input buffer, shards have their own
+        vector<shared_future<void>> m_stageFutures;
+        std::multimap<StageId, StageId> m_connections;
+        std::set<StageId> m_orderedStages;
+        map<StageId, PipelineStage::KeyExtractor> m_shardKeys;
+        map<StageId, StageId> m_fused;      ///< fused stage, the stage whose thread it runs on
+        Placement m_placement;
+        vector<int> m_placementCpus;
+        vector<int> m_workerCpus;       ///< per stage instance, in m_stages order
+
+        map<StageId, ScaledStage> m_scaled;
+        mutable std::mutex m_scalingMux;    ///< m_scaled, which the scaling timer changes while the pipeline runs
+        std::chrono::milliseconds m_scalingInterval;
+        IntervalTimer m_scalingTimer;
+        shared_ptr<Poco::NotificationCenter> m_nc;
+    };
+}
+
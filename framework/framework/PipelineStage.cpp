@@ -1,108 +1,389 @@
-#include "PipelineStage.hpp"
-
-
-namespace framework
-{
-    PipelineStage::PipelineStage(const string& name, const BufferType buffType) : m_name(name), m_id(0), m_stopRequest(false), m_pauseState(PauseState::PauseEnd)
-    {
-        if (buffType == BufferType::Queue)
-        {
-            m_data = std::make_unique<DataQueue>();
-        }
-        else
-        {
-            throw std::runtime_error("Invalid stage buffer type");
-        }
-    }
-
-
-    PipelineStage::~PipelineStage()
-    {
-        if (m_nc)
-        {
-            m_nc->removeObserver(Poco::NObserver<PipelineStage, StageCommand>(*this, &PipelineStage::handleStageCommand));
-        }
-    }
-
-    
-    void PipelineStage::initialise(const StageId id, const shared_ptr<Poco::NotificationCenter>& nc)
-    {
-        m_id = id;
-
-        m_nc = nc;
-        m_nc->addObserver(Poco::NObserver<PipelineStage, StageCommand>(*this, &PipelineStage::handleStageCommand));
-    }
-
-
-    void PipelineStage::injectData(const shared_ptr<StageData>& data)
-    {
-        m_data->add(data);
-    }
-    
-
-    void PipelineStage::handleStageCommand(const Poco::AutoPtr<StageCommand>& pCommand)
-    {
-        if (pCommand->targetStageId == m_id)
-        {
-            switch (pCommand->cmd)
-            {
-            case StageCommand::Command::CommandDataAvailable:
-                injectData(pCommand->data);
-                break;
-
-            default:
-                // ignore
-                break;
-            }
-        }
-    }
-
-
-    void PipelineStage::handleStageNotification(const Poco::AutoPtr<PipelineStageControlNotification>& notification)
-    {
-        // request to pause/restart this stage
-        if (notification->stageSendId == m_id)
-        {
-            if (notification->control == PipelineStageControlNotification::Control::StagePause)
-            {
-                m_pauseState.store(PauseState::Requested);
-            }
-            else if (notification->control == PipelineStageControlNotification::Control::StageRestart)
-            {
-                m_pauseState.store(PauseState::PauseEnd);
-                m_cvPause.notify_all();
-            }
-        }
-    }
-
-
-    void PipelineStage::stopStage()
-    {
-        m_stopRequest.store(true);
-        m_cvPause.notify_all();
-    }
-
-
-    bool PipelineStage::shouldStop()
-    {
-        return m_stopRequest.load();
-    }
-
-    bool PipelineStage::isPauseRequested() const
-    {
-        return m_pauseState.load() == PauseState::Requested;
-    }
-
-
-    void PipelineStage::enterPause()
-    {
-        m_pauseState.store(PauseState::Paused);
-
-        // wait here until we're out of pause
-        std::unique_lock<mutex> lock(m_muxPause);
-        
-        m_cvPause.wait(lock);
-
-        m_pauseState.store(PauseState::PauseEnd);
-    }
+#include "PipelineStage.hpp"
+#include "Executor.hpp"
+
+
+namespace framework
+{
+    PipelineStage::PipelineStage(const string& name, const BufferType buffType, const size_t bufferCapacity) 
+        : PipelineStage(name, BufferConfig{ buffType, buffType == BufferType::Queue ? 0U : bufferCapacity })
+    {
+
+    }
+
+
+    PipelineStage::PipelineStage(const string& name, const BufferConfig& bufferConfig) 
+        :   m_name(name), m_id(0), m_stopRequest(false), m_sequenced(false),
+            m_itemsIn(0), m_itemsOut(0), m_waitNs(0), m_busyNs(0), m_forwardNs(0), m_peakDepth(0), m_idleSinceTake(0),
+            m_pauseState(PauseState::PauseEnd)
+    {
+        if (bufferConfig.type == BufferType::Queue)
+        {
+            m_data = std::make_shared<DataQueue>(bufferConfig.capacity, bufferConfig.overflow, bufferConfig.wake);
+        }
+        else if (bufferConfig.type == BufferType::RingBuffer)
+        {
+            if (bufferConfig.capacity == 0 || bufferConfig.overflow == OverflowPolicy::DropOldest)
+                throw std::runtime_error("Invalid ring buffer config, capacity must be > 0 and DropOldest is not supported");
+
+            m_data = std::make_shared<RingBuffer>(bufferConfig.capacity, bufferConfig.overflow, bufferConfig.wake);
+        }
+        else if (bufferConfig.type == BufferType::PriorityQueue)
+        {
+            const auto& weights = bufferConfig.laneWeights;
+
+            if (weights.empty() || std::find(weights.begin(), weights.end(), 0U) != weights.end())
+                throw std::runtime_error("Invalid priority queue config, requires a weight > 0 for each lane");
+
+            m_data = std::make_shared<LaneQueue>(weights, bufferConfig.capacity, bufferConfig.overflow, bufferConfig.wake);
+        }
+        else if (bufferConfig.type == BufferType::Spill)
+        {
+            if (bufferConfig.capacity == 0 || !bufferConfig.spill.serialize || !bufferConfig.spill.deserialize)
+                throw std::runtime_error("Invalid spill buffer config, requires a capacity > 0 and serializer functions");
+
+            m_data = std::make_shared<SpillQueue>(bufferConfig.capacity, bufferConfig.spill, bufferConfig.wake);
+        }
+        else
+        {
+            throw std::runtime_error("Invalid stage buffer type");
+        }
+    }
+
+
+    PipelineStage::~PipelineStage()
+    {
+        if (m_nc)
+        {
+            m_nc->removeObserver(Poco::NObserver<PipelineStage, StageCommand>(*this, &PipelineStage::handleStageCommand));
+            m_nc->removeObserver(Poco::NObserver<PipelineStage, PipelineStageControlNotification>(*this, &PipelineStage::handleStageNotification));
+        }
+    }
+
+    
+    void PipelineStage::initialise(const StageId id, const shared_ptr<Poco::NotificationCenter>& nc)
+    {
+        m_id = id;
+
+        m_nc = nc;
+        m_nc->addObserver(Poco::NObserver<PipelineStage, StageCommand>(*this, &PipelineStage::handleStageCommand));
+        m_nc->addObserver(Poco::NObserver<PipelineStage, PipelineStageControlNotification>(*this, &PipelineStage::handleStageNotification));
+    }
+
+
+    void PipelineStage::connect(PipelineStage& next, const bool ordered)
+    {
+        next.m_data->hasProducers = true;
+        addOutput(next.m_data, ordered);
+    }
+
+
+    void PipelineStage::connectFused(PipelineStage& next, const bool ordered)
+    {
+        next.m_data->hasProducers = true;
+        addOutput(std::make_shared<FusedBuffer>(next), ordered);
+    }
+
+
+    void PipelineStage::connect(const std::vector<shared_ptr<PipelineStage>>& shards, KeyExtractor key, const bool ordered)
+    {
+        std::vector<shared_ptr<StageBuffer>> shardBuffers;
+
+        for (auto& shard : shards)
+        {
+            shard->m_data->hasProducers = true;
+            shardBuffers.push_back(shard->m_data);
+        }
+
+        addOutput(std::make_shared<ShardBuffer>(std::move(shardBuffers), std::move(key)), ordered);
+    }
+
+
+    void PipelineStage::addOutput(const shared_ptr<StageBuffer>& output, const bool ordered)
+    {
+        if (ordered)
+        {
+            m_outputs.push_back(std::make_shared<ReorderBuffer>(output));
+        }
+        else
+        {
+            m_outputs.push_back(output);
+        }
+    }
+
+
+    void PipelineStage::shareOutputs(const PipelineStage& primary)
+    {
+        m_outputs = primary.m_outputs;
+        m_router = primary.m_router;
+    }
+
+
+    void PipelineStage::sequenceInput()
+    {
+        m_data = std::make_shared<SequenceBuffer>(m_data);
+        m_sequenced = true;
+    }
+
+
+    void PipelineStage::completeSequences()
+    {
+        for (const uint64_t sequence : m_inputSequences)
+        {
+            for (auto& output : m_outputs)
+            {
+                output->complete(sequence);
+            }
+        }
+
+        m_inputSequences.clear();
+    }
+
+
+    // keep the first result that isn't a plain add, unless the buffer is closed
+    static BufferResult combineResults(const BufferResult overall, const BufferResult result)
+    {
+        return (overall == BufferResult::Added || result == BufferResult::Closed) ? result : overall;
+    }
+
+
+    BufferResult PipelineStage::forward(const shared_ptr<StageData>& data)
+    {
+        if (m_outputs.empty())
+        {
+            return BufferResult::Rejected;
+        }
+        else if (m_router)
+        {
+            const size_t output = m_router(*data);
+            return output < m_outputs.size() ? m_outputs[output]->add(data) : BufferResult::Rejected;
+        }
+        else
+        {
+            BufferResult result = BufferResult::Added;
+
+            for (auto& output : m_outputs)
+            {
+                result = combineResults(result, output->add(data));
+            }
+
+            return result;
+        }
+    }
+
+
+    BufferResult PipelineStage::forwardBatch(const std::vector<shared_ptr<StageData>>& batch)
+    {
+        if (m_outputs.empty())
+        {
+            return BufferResult::Rejected;
+        }
+
+        BufferResult result = BufferResult::Added;
+
+        if (m_router)
+        {
+            m_batchRouted.resize(m_outputs.size());
+
+            for (auto& data : batch)
+            {
+                if (const size_t output = m_router(*data); output < m_outputs.size())
+                    m_batchRouted[output].push_back(data);
+                else
+                    result = combineResults(result, BufferResult::Rejected);
+            }
+
+            for (size_t output = 0; output < m_outputs.size(); ++output)
+            {
+                if (!m_batchRouted[output].empty())
+                {
+                    result = combineResults(result, m_outputs[output]->addBatch(m_batchRouted[output].data(), m_batchRouted[output].size()));
+                    m_batchRouted[output].clear();
+                }
+            }
+        }
+        else
+        {
+            for (auto& output : m_outputs)
+            {
+                result = combineResults(result, output->addBatch(batch.data(), batch.size()));
+            }
+        }
+
+        return result;
+    }
+
+
+    StageMetrics PipelineStage::metrics() const
+    {
+        StageMetrics metrics;
+
+        metrics.name = m_name;
+        metrics.itemsIn = m_itemsIn.load(std::memory_order_relaxed);
+        metrics.itemsOut = m_itemsOut.load(std::memory_order_relaxed);
+        metrics.queueDepth = m_data->queueSize();
+        metrics.peakQueueDepth = std::max(m_peakDepth.load(std::memory_order_relaxed), metrics.queueDepth);
+        metrics.waitTime = std::chrono::nanoseconds(m_waitNs.load(std::memory_order_relaxed));
+        metrics.busyTime = std::chrono::nanoseconds(m_busyNs.load(std::memory_order_relaxed));
+        metrics.forwardTime = std::chrono::nanoseconds(m_forwardNs.load(std::memory_order_relaxed));
+
+        return metrics;
+    }
+
+
+    bool PipelineStage::outputFull(const StageData& data) const
+    {
+        if (m_router)
+        {
+            const size_t output = m_router(data);
+            return output < m_outputs.size() && m_outputs[output]->full();
+        }
+
+        return std::any_of(m_outputs.begin(), m_outputs.end(), [](auto& output) { return output->full(); });
+    }
+
+
+    bool PipelineStage::notifyOnSpace(const StageData& data, EventCount::Waiter& waiter)
+    {
+        if (m_router)
+        {
+            const size_t output = m_router(data);
+            return output < m_outputs.size() && m_outputs[output]->notifyOnSpace(waiter);
+        }
+
+        auto full = std::find_if(m_outputs.begin(), m_outputs.end(), [](auto& output) { return output->full(); });
+
+        return full != m_outputs.end() && (*full)->notifyOnSpace(waiter);
+    }
+
+
+    BufferResult PipelineStage::injectData(const shared_ptr<StageData>& data)
+    {
+        if (!data)
+            return BufferResult::Rejected;
+
+        if (m_budget && !data->chargeBudget(m_budget, true))
+            return refusedByBudget();
+
+        // before the add, so the stage sees it once it takes the data
+        if (!m_data->hasProducers.load(std::memory_order_relaxed))
+            m_data->hasProducers.store(true, std::memory_order_relaxed);
+
+        const auto now = std::chrono::steady_clock::now();
+
+        data->stampInjected(now);
+        data->stampEnqueued(now);
+
+        return m_data->add(data);
+    }
+    
+
+    BufferResult PipelineStage::processFused(const shared_ptr<StageData>& data)
+    {
+        if (shouldStop())
+            return BufferResult::Closed;
+
+        const auto start = Clock::now();
+        const uint64_t forwarded = m_forwardNs.load(std::memory_order_relaxed);
+
+        // taken as soon as it's added, so there is no wait and no dwell
+        m_lastTake = start;
+        addTo(m_itemsIn, 1U);
+        recordLatency(*data);
+
+        process(shared_ptr<StageData>(data));
+
+        // busy while in process(), except passing results on
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        const auto forwarding = static_cast<int64_t>(m_forwardNs.load(std::memory_order_relaxed) - forwarded);
+
+        addTo(m_busyNs, static_cast<uint64_t>(std::max<int64_t>(elapsed - forwarding, 0)));
+
+        return BufferResult::Added;
+    }
+
+
+    void PipelineStage::parallelFor(const size_t count, const std::function<void(size_t)>& body)
+    {
+        if (count == 1U)
+        {
+            body(0);
+            return;
+        }
+
+        (m_parallelExecutor ? m_parallelExecutor : Executor::shared())->parallelFor(count, body);
+    }
+
+
+    void PipelineStage::handleStageCommand(const Poco::AutoPtr<StageCommand>& pCommand)
+    {
+        if (pCommand->targetStageId == m_id)
+        {
+            switch (pCommand->cmd)
+            {
+            case StageCommand::Command::CommandDataAvailable:
+                pCommand->result = injectData(pCommand->data);
+                break;
+
+            default:
+                // ignore
+                break;
+            }
+        }
+    }
+
+
+    void PipelineStage::handleStageNotification(const Poco::AutoPtr<PipelineStageControlNotification>& notification)
+    {
+        // request to pause/restart this stage
+        if (notification->stageSendId == m_id)
+        {
+            if (notification->control == PipelineStageControlNotification::Control::StagePause)
+            {
+                m_pauseState.store(PauseState::Requested);
+            }
+            else if (notification->control == PipelineStageControlNotification::Control::StageRestart)
+            {
+                m_pauseState.store(PauseState::PauseEnd);
+                m_cvPause.notify_all();
+            }
+        }
+    }
+
+
+    void PipelineStage::stopStage()
+    {
+        stopInstance();
+        m_data->close();
+    }
+
+
+    void PipelineStage::stopInstance()
+    {
+        m_stopRequest.store(true);
+        m_cvPause.notify_all();
+    }
+
+
+    bool PipelineStage::shouldStop()
+    {
+        return m_stopRequest.load();
+    }
+
+    bool PipelineStage::isPauseRequested() const
+    {
+        return m_pauseState.load() == PauseState::Requested;
+    }
+
+
+    void PipelineStage::enterPause()
+    {
+        m_pauseState.store(PauseState::Paused);
+
+        // wait here until we're out of pause
+        std::unique_lock<mutex> lock(m_muxPause);
+        
+        m_cvPause.wait(lock);
+
+        m_pauseState.store(PauseState::PauseEnd);
+    }
 }
\ No newline at end of file
@@ -1,242 +1,2016 @@
-#pragma once
-
-#include <functional>
-#include <future>
-#include <string>
-#include <map>
-#include <atomic>
-#include <queue>
-#include <condition_variable>
-#include <chrono>
-
-#include <Poco/NotificationCenter.h>
-#include <Poco/Notification.h>
-#include <Poco/NObserver.h>
-#include <Poco/AutoPtr.h>
-
-
-namespace framework
-{
-    using std::shared_ptr;
-    using std::string;
-    using std::map;
-    using std::queue;
-    using std::mutex;
-
-    
-    typedef unsigned short StageId;
-
-
-    //TODO consider std::variant
-    class StageData
-    {
-    public:
-        StageData() = default;
-        virtual ~StageData() = default;        
-
-        bool isFinalData() const { return m_finalData.load(); }
-        void isFinalData(bool final) { m_finalData.store(final); }
-
-    private:
-        std::atomic_bool m_finalData;
-    };
-
-
-    struct StageCommand : public Poco::Notification
-    {
-        enum class Command { CommandNone, CommandDataAvailable };
-
-        StageCommand(const Command c = Command::CommandNone) : cmd(c), senderStageId(0), targetStageId(0), data(nullptr)
-        {
-
-        }
-
-        StageCommand(const StageId targetId, const StageId senderId, const shared_ptr<StageData>& d)
-            :   cmd(Command::CommandDataAvailable),
-                targetStageId(targetId),
-                senderStageId(senderId),
-                data(d)
-        {
-
-        }
-
-        Command cmd;
-        StageId senderStageId;
-        StageId targetStageId;
-        shared_ptr<StageData> data;
-    };
-
-
-    struct PipelineStageControlNotification : public Poco::Notification
-    {
-        enum class Control { StagePause, StageRestart };
-
-        PipelineStageControlNotification(const Control c, const size_t stageId, const std::string& stageName) : control(c), stageSendId(stageId), stagename(stageName)
-        {
-
-        }
-
-        virtual std::string name() const override
-        {
-            return stagename;
-        }
-
-        size_t stageSendId;
-        Control control;
-        std::string stagename;
-    };
-
-
-    using namespace std::chrono_literals;
-
-
-    class PipelineStage
-    {
-    public:
-        
-
-    private:
-
-        // prefer this to templating PipelineStage, i.e. with the buffer as template argument
-        enum class BufferType { Queue };
-
-        
-
-        /// Interface which provides a FIFO buffer for stage data. 
-        /// Implementions must be thread safe.
-        struct StageBuffer
-        {
-            virtual void initialise() {};
-            virtual void add(const shared_ptr<StageData>& d) = 0;
-            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) = 0;
-            virtual bool hasData() = 0;
-            virtual size_t queueSize() const = 0;
-        };
-
-
-        /// We'll start with a std::queue, but later we may wish
-        /// to use an array implemented as a ring buffer for more control and potentially more performance.
-        struct DataQueue : public StageBuffer
-        {
-            DataQueue() 
-            {
-
-            }
-
-            virtual void add(const shared_ptr<StageData>& d) override
-            {
-                {
-                    std::scoped_lock lock(queueMux);
-                    queue.push(d);
-                }
-
-                newDataCV.notify_one();
-            }
-
-
-            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) override
-            {
-                shared_ptr<StageData> data;
-
-                std::unique_lock cvLock(newDataCvMux);
-                newDataCV.wait_for(cvLock, waitMs);
-
-                if (hasData())
-                {
-                    std::scoped_lock cvLock(queueMux);
-                    data = queue.front();
-                    queue.pop();
-                }
-
-                return data;
-            }
-
-
-            virtual bool hasData() override
-            {
-                std::scoped_lock lock(queueMux);
-                return !queue.empty();
-            }
-
-
-            virtual size_t queueSize() const override
-            {
-                std::scoped_lock lock(queueMux);
-                return queue.size();
-            }
-
-            std::queue<shared_ptr<StageData>> queue;
-            mutable std::mutex queueMux;
-            std::mutex newDataCvMux;
-            std::condition_variable newDataCV;
-        };
-
-
-    protected:        
-        enum PauseState { Requested, Paused, PauseEnd };
-
-
-        PipelineStage(const string& name = "", const BufferType buffType = BufferType::Queue);
-        virtual ~PipelineStage();
-
-
-        bool isPauseRequested() const;
-        void enterPause();
-
-
-    public:
-
-        const string& name() const { return m_name; }
-        StageId id() const { return m_id; }
-
-        virtual void initialise(const StageId id, const shared_ptr<Poco::NotificationCenter>& nc);
-
-        virtual void run() = 0;
-
-        virtual void stopStage();
-
-        inline void injectData(const shared_ptr<StageData>& data);
-
-        void handleStageCommand(const Poco::AutoPtr<StageCommand>& pNf);
-        void handleStageNotification(const Poco::AutoPtr<PipelineStageControlNotification>& notification);
-
-
-        size_t queueSize() const { return m_data->queueSize(); }
-
-    protected:
-
-        bool shouldStop();
-
-
-        void dataComplete(shared_ptr<StageData>&& data)
-        {
-            const StageId targetStage = (m_id + 1U);    // we assume it's the next stage
-            m_nc->postNotification(new StageCommand(targetStage, m_id, std::move(data))); 
-        }
-
-
-        template<class DataT = StageData>
-        shared_ptr<DataT> nextData(const std::chrono::milliseconds& waitMs = 100ms)
-        {
-            return std::dynamic_pointer_cast<DataT>(m_data->next(waitMs));
-        }
-
-
-        shared_ptr<StageData> nextData(const std::chrono::milliseconds& waitMs = 100ms)
-        {
-            return nextData<>(waitMs);
-        }
-
-
-    private:
-        string m_name;
-        StageId m_id;
-        std::atomic_bool m_stopRequest;
-        std::unique_ptr<StageBuffer> m_data;
-        shared_ptr<Poco::NotificationCenter> m_nc;
-
-        mutable std::mutex m_muxPause;
-        std::condition_variable m_cvPause;
-        std::atomic<PauseState> m_pauseState;
-    };
+#pragma once
+
+#include <functional>
+#include <future>
+#include <string>
+#include <map>
+#include <set>
+#include <atomic>
+#include <queue>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+#include <memory>
+#include <cstring>
+
+#include <Poco/NotificationCenter.h>
+#include <Poco/Notification.h>
+#include <Poco/NObserver.h>
+#include <Poco/AutoPtr.h>
+
+#include "EventCount.hpp"
+#include "LatencyHistogram.hpp"
+#include "MemoryBudget.hpp"
+#include "SpillSegment.hpp"
+#include "Logger.hpp"
+
+
+namespace framework
+{
+    using std::shared_ptr;
+    using std::string;
+    using std::map;
+    using std::queue;
+    using std::mutex;
+
+    
+    typedef unsigned short StageId;
+
+
+    /// Outcome of adding data to a stage's buffer.
+    enum class BufferResult { Added, DroppedOldest, DroppedNewest, Rejected, Closed };
+
+
+    /// Snapshot of a stage's counters, see PipelineStage::metrics() and Pipeline::metrics().
+    struct StageMetrics
+    {
+        string name;
+        uint64_t itemsIn = 0;                       ///< taken by nextData()/nextBatch()
+        uint64_t itemsOut = 0;                      ///< passed to dataComplete()
+        size_t queueDepth = 0;                      ///< items in the input buffer now
+        size_t peakQueueDepth = 0;                  ///< most items seen in the input buffer when taking data
+        std::chrono::nanoseconds waitTime{ 0 };     ///< blocked in nextData()/nextBatch()
+        std::chrono::nanoseconds busyTime{ 0 };     ///< in run(), between taking data and asking for more, excluding forwardTime
+        std::chrono::nanoseconds forwardTime{ 0 };  ///< blocked in dataComplete(), i.e. on a full next stage
+    };
+
+
+    //TODO consider std::variant
+    class StageData
+    {
+    public:
+        StageData() = default;
+
+        virtual ~StageData()
+        {
+            releaseBudget();
+        }
+
+        /// Bytes the data holds, counted against Pipeline::setMemoryBudget(). Override for data with large 
+        /// payloads, data which reports 0 isn't counted.
+        virtual size_t byteSize() const { return 0; }
+
+        bool isFinalData() const { return m_finalData.load(); }
+        void isFinalData(bool final) { m_finalData.store(final); }
+
+        /// Which lane of a BufferType::PriorityQueue the data goes in, higher is more urgent. 0 by default.
+        unsigned priority() const { return m_priority; }
+        void priority(const unsigned p) { m_priority = p; }
+
+        /// Set when entering an ordered, replicated stage so the order can be restored after it, starting at 1.
+        /// 0 if the data hasn't entered one.
+        uint64_t sequence() const { return m_sequence; }
+        void sequence(const uint64_t seq) { m_sequence = seq; }
+
+        /// When the data entered the pipeline: injected, or first passed on by a stage with no inputs which created it.
+        /// Data created by other stages has the inject time of the input it was created from.
+        std::chrono::steady_clock::time_point injectTime() const { return toTime(m_injectTime); }
+
+        /// When the data was last added to a stage's buffer.
+        std::chrono::steady_clock::time_point enqueueTime() const { return toTime(m_enqueueTime); }
+
+        /// Set by the pipeline as the data is added to a buffer.
+        void stampEnqueued(const std::chrono::steady_clock::time_point& now)
+        {
+            m_enqueueTime.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        /// Set by the pipeline as the data is first passed on, only if it isn't already set.
+        void stampInjected(const std::chrono::steady_clock::time_point& injected)
+        {
+            if (m_injectTime.load(std::memory_order_relaxed) == 0)
+                m_injectTime.store(injected.time_since_epoch().count(), std::memory_order_relaxed);
+        }
+
+        /// Counts byteSize() against budget as the data is added to a buffer, if it isn't already counted.
+        /// Data entering the pipeline, injected or from a stage with no inputs, acquires the bytes, which may wait. 
+        /// Data created by other stages is charged without waiting: they may hold data only they can release.
+        /// Returns false if the budget refused the data.
+        bool chargeBudget(const shared_ptr<MemoryBudget>& budget, const bool entering)
+        {
+            if (m_chargedBytes.load(std::memory_order_relaxed) != 0)
+                return true;
+
+            const size_t bytes = byteSize();
+
+            if (bytes == 0)
+                return true;
+
+            if (entering)
+            {
+                if (!budget->acquire(bytes))
+                    return false;
+            }
+            else
+            {
+                budget->charge(bytes);
+            }
+
+            m_budget = budget;
+            m_chargedBytes.store(bytes, std::memory_order_relaxed);
+
+            return true;
+        }
+
+        /// Called as a stage takes the data from its buffer, or the data is destroyed or reset if it never is,
+        /// i.e. dropped. Data sent to several outputs is counted once, until the first takes it.
+        void releaseBudget()
+        {
+            if (const size_t bytes = m_chargedBytes.exchange(0U); bytes != 0)
+                m_budget->release(bytes);
+        }
+
+        /// What the pipeline stores in the data, kept by buffers which serialize it.
+        struct Stamps
+        {
+            int64_t injectTime;
+            int64_t enqueueTime;
+            uint64_t sequence;
+            unsigned priority;
+            bool finalData;
+        };
+
+        Stamps stamps() const
+        {
+            return Stamps{ m_injectTime.load(std::memory_order_relaxed), m_enqueueTime.load(std::memory_order_relaxed), m_sequence, m_priority, m_finalData.load() };
+        }
+
+        void restoreStamps(const Stamps& stamps)
+        {
+            m_injectTime.store(stamps.injectTime, std::memory_order_relaxed);
+            m_enqueueTime.store(stamps.enqueueTime, std::memory_order_relaxed);
+            m_sequence = stamps.sequence;
+            m_priority = stamps.priority;
+            m_finalData.store(stamps.finalData);
+        }
+
+        /// Clears what the pipeline stores in the data, for when the object is reused, i.e. by a StageDataPool.
+        void resetStageData()
+        {
+            releaseBudget();
+
+            m_finalData.store(false);
+            m_sequence = 0;
+            m_priority = 0;
+            m_injectTime.store(0, std::memory_order_relaxed);
+            m_enqueueTime.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        static std::chrono::steady_clock::time_point toTime(const std::atomic<int64_t>& ns)
+        {
+            return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(ns.load(std::memory_order_relaxed)));
+        }
+
+    private:
+        std::atomic_bool m_finalData{ false };
+        uint64_t m_sequence = 0;
+        unsigned m_priority = 0;
+
+        // steady_clock ticks, atomic because data sent to multiple outputs is stamped by each branch
+        std::atomic<int64_t> m_injectTime{ 0 };
+        std::atomic<int64_t> m_enqueueTime{ 0 };
+
+        shared_ptr<MemoryBudget> m_budget;
+        std::atomic_size_t m_chargedBytes{ 0 };
+    };
+
+
+    struct StageCommand : public Poco::Notification
+    {
+        enum class Command { CommandNone, CommandDataAvailable };
+
+        StageCommand(const Command c = Command::CommandNone) : cmd(c), senderStageId(0), targetStageId(0), data(nullptr), result(BufferResult::Rejected)
+        {
+
+        }
+
+        StageCommand(const StageId targetId, const StageId senderId, const shared_ptr<StageData>& d)
+            :   cmd(Command::CommandDataAvailable),
+                targetStageId(targetId),
+                senderStageId(senderId),
+                data(d),
+                result(BufferResult::Rejected)
+        {
+
+        }
+
+        Command cmd;
+        StageId senderStageId;
+        StageId targetStageId;
+        shared_ptr<StageData> data;
+        BufferResult result;    ///< set by the target stage, notifications are delivered synchronously
+    };
+
+
+    struct PipelineStageControlNotification : public Poco::Notification
+    {
+        enum class Control { StagePause, StageRestart };
+
+        PipelineStageControlNotification(const Control c, const size_t stageId, const std::string& stageName) : control(c), stageSendId(stageId), stagename(stageName)
+        {
+
+        }
+
+        virtual std::string name() const override
+        {
+            return stagename;
+        }
+
+        size_t stageSendId;
+        Control control;
+        std::string stagename;
+    };
+
+
+    using namespace std::chrono_literals;
+
+
+    class Executor;
+
+
+    class PipelineStage
+    {
+    public:
+        
+        // prefer this to templating PipelineStage, i.e. with the buffer as template argument
+        enum class BufferType 
+        { 
+            Queue, 
+            RingBuffer,
+            PriorityQueue,  ///< a lane per StageData::priority(), weighted by BufferConfig::laneWeights
+            Spill           ///< capacity items in memory, the rest spilled to disk, see BufferConfig::spill
+        };
+
+        /// What a bounded buffer does when data is added while it's full. 
+        enum class OverflowPolicy 
+        { 
+            Block,      ///< producer waits until there is space, this backs up to Pipeline::injectData()
+            DropOldest, ///< discard the oldest item to make space (not supported by RingBuffer)
+            DropNewest, ///< discard the item being added
+            Fail        ///< don't add, return BufferResult::Rejected
+        };
+
+        static const size_t DefaultBufferCapacity = 1024U;
+
+        /// Chooses which of a stage's outputs an item goes to, returning an index in the order the
+        /// outputs were connected. Without a router, data is sent to every output.
+        using Router = std::function<size_t(const StageData&)>;
+
+        /// Returns the key used to choose an item's shard of a sharded stage: the key itself if integral, 
+        /// otherwise a hash of it. Items with the same key always go to the same shard.
+        using KeyExtractor = std::function<size_t(const StageData&)>;
+
+        /// Index of the shard for key.
+        static size_t shardFor(const size_t key, const size_t nShards)
+        {
+            // Fibonacci hash so sequential keys spread across the shards
+            return static_cast<size_t>((static_cast<uint64_t>(key) * 11400714819323198485ULL) >> 32U) % nShards;
+        }
+
+
+        /// How a BufferType::Spill buffer writes data to disk and reads it back.
+        struct SpillConfig
+        {
+            using Serializer = std::function<void(const StageData&, std::vector<char>&)>;     ///< appends the data's bytes to the vector
+            using Deserializer = std::function<shared_ptr<StageData>(const char*, const size_t)>;
+
+            Serializer serialize;
+            Deserializer deserialize;
+            string directory;                               ///< for the segment files, the system's temp directory if empty
+            size_t segmentSize = 64U * 1024U * 1024U;       ///< larger items get a segment of their own size
+            size_t spareSegments = 1U;                      ///< drained segments kept for reuse rather than deleted
+        };
+
+
+        struct BufferConfig
+        {
+            /// The common settings, the rest are set by name, so callers needn't list every field.
+            explicit BufferConfig(const BufferType bufferType = BufferType::Queue, const size_t bufferCapacity = 0, 
+                                  const OverflowPolicy overflowPolicy = OverflowPolicy::Block, const WakeStrategy wakeStrategy = WakeStrategy::Block)
+                : type(bufferType), capacity(bufferCapacity), overflow(overflowPolicy), wake(wakeStrategy)
+            {
+
+            }
+
+            BufferType type = BufferType::Queue;
+            size_t capacity = 0;    ///< 0 is unbounded, only valid for BufferType::Queue
+            OverflowPolicy overflow = OverflowPolicy::Block;
+            WakeStrategy wake = WakeStrategy::Block;    ///< how this stage waits in nextData() when its buffer is empty
+
+            /// BufferType::PriorityQueue only: a weight per lane, lowest priority first, so the number of lanes is
+            /// laneWeights.size(). Data with a higher priority than the last lane goes in the last lane.
+            std::vector<unsigned> laneWeights;
+
+            /// BufferType::Spill only, which requires a capacity and both serializer functions.
+            SpillConfig spill;
+        };
+
+
+    private:
+
+        /// Interface which provides a FIFO buffer for stage data. 
+        /// Implementions must be thread safe.
+        struct StageBuffer
+        {
+            virtual ~StageBuffer() = default;
+
+            virtual void initialise() {};
+            virtual BufferResult add(const shared_ptr<StageData>& d) = 0;
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) = 0;
+            virtual bool hasData() = 0;
+            virtual size_t queueSize() const = 0;
+
+
+            /// Adds count items. Returns BufferResult::Added only if every item was added and nothing was dropped, 
+            /// otherwise the result for the last item that wasn't simply added.
+            /// Implementations should override to add the batch under a single lock/publish.
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count)
+            {
+                BufferResult result = BufferResult::Added;
+
+                for (size_t i = 0; i < count && result != BufferResult::Closed; ++i)
+                {
+                    if (const auto r = add(items[i]); r != BufferResult::Added)
+                        result = r;
+                }
+
+                return result;
+            }
+
+
+            /// Appends up to maxItems to out, waiting up to waitMs if there is no data. Returns the number appended.
+            /// Implementations should override to take the batch under a single lock/wakeup.
+            virtual size_t nextBatch(std::vector<shared_ptr<StageData>>& out, const size_t maxItems, const std::chrono::milliseconds& waitMs)
+            {
+                size_t count = 0;
+
+                for (auto data = maxItems ? next(waitMs) : nullptr; data; data = next(0ms))
+                {
+                    out.push_back(std::move(data));
+
+                    if (++count == maxItems)
+                        break;
+                }
+
+                return count;
+            }
+
+            /// Called when the owning stage stops, so a producer waiting for space is released.
+            virtual void close() {};
+
+            /// Reallocates preallocated storage from the calling thread so, with first touch, it's on that thread's
+            /// NUMA node. Only called before the pipeline starts.
+            virtual void localise() {};
+
+            /// For consumers which mustn't block their thread: arranges for waiter.wake() to be called once, when there 
+            /// may be data or the buffer is closed. Returns false, without arranging a call, if there may already be data 
+            /// or the buffer can't notify, i.e. it has another waiter, so the caller should try again later.
+            virtual bool notifyOnData(EventCount::Waiter&) { return false; }
+
+            /// For producers which mustn't block their thread: as notifyOnData(), when full() may have become false.
+            virtual bool notifyOnSpace(EventCount::Waiter&) { return false; }
+
+            /// True if add() would wait for space.
+            virtual bool full() const { return false; }
+
+            /// If false, only one stage may output to this buffer.
+            virtual bool multiProducer() const { return true; }
+
+            /// If false, only one stage may take from this buffer, so it can't be shared by replicas.
+            virtual bool multiConsumer() const { return true; }
+
+            /// True if add() may discard data rather than wait, i.e. not OverflowPolicy::Block.
+            virtual bool dropsData() const { return false; }
+
+            /// For ordered outputs: the stage has passed on everything it will for its input with this sequence number.
+            virtual void complete(const uint64_t) {}
+
+            /// Set when a stage is connected to output to this buffer, or data is injected into it. Buffers are shared 
+            /// by replicas, so this is here rather than in the stage.
+            std::atomic_bool hasProducers{ false };
+        };
+
+
+        /// Multi producer/multi consumer queue, optionally bounded with a capacity > 0.
+        struct DataQueue : public StageBuffer
+        {
+            DataQueue(const size_t cap = 0, const OverflowPolicy policy = OverflowPolicy::Block, const WakeStrategy wakeStrategy = WakeStrategy::Block) 
+                : capacity(cap), overflow(policy), wake(wakeStrategy), closed(false), depth(0)
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override
+            {
+                BufferResult result = BufferResult::Added;
+
+                {
+                    std::unique_lock lock(queueMux);
+
+                    if (closed)
+                        return BufferResult::Closed;
+
+                    if (capacity && queue.size() >= capacity)
+                    {
+                        switch (overflow)
+                        {
+                        case OverflowPolicy::Block:
+                            spaceCV.wait(lock, [this] { return queue.size() < capacity || closed; });
+                            if (closed)
+                                return BufferResult::Closed;
+                            break;
+
+                        case OverflowPolicy::DropOldest:
+                            queue.pop();
+                            result = BufferResult::DroppedOldest;
+                            break;
+
+                        case OverflowPolicy::DropNewest:
+                            return BufferResult::DroppedNewest;
+
+                        default:
+                            return BufferResult::Rejected;
+                        }
+                    }
+
+                    queue.push(d);
+                    depth.store(queue.size());
+                }
+
+                dataEvent.notifyOne();
+
+                return result;
+            }
+
+
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) override
+            {
+                shared_ptr<StageData> data;
+
+                if (dataEvent.waitFor([this] { return depth.load() > 0 || closed.load(); }, waitMs, wake))
+                {
+                    std::scoped_lock lock(queueMux);
+
+                    if (!queue.empty())
+                    {
+                        data = std::move(queue.front());
+                        queue.pop();
+                        depth.store(queue.size());
+                    }
+                }
+
+                if (data && capacity)
+                {
+                    spaceCV.notify_one();
+                    spaceEvent.notifyOne();
+                }
+
+                return data;
+            }
+
+
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count) override
+            {
+                BufferResult result = BufferResult::Added;
+
+                {
+                    std::unique_lock lock(queueMux);
+
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        if (closed)
+                            return BufferResult::Closed;
+
+                        if (capacity && queue.size() >= capacity)
+                        {
+                            if (overflow == OverflowPolicy::Block)
+                            {
+                                // let the consumer see what we've added so far before waiting for it to make space
+                                depth.store(queue.size());
+                                dataEvent.notifyAll();
+                                spaceCV.wait(lock, [this] { return queue.size() < capacity || closed; });
+
+                                if (closed)
+                                    return BufferResult::Closed;
+                            }
+                            else if (overflow == OverflowPolicy::DropOldest)
+                            {
+                                queue.pop();
+                                result = BufferResult::DroppedOldest;
+                            }
+                            else
+                            {
+                                result = overflow == OverflowPolicy::DropNewest ? BufferResult::DroppedNewest : BufferResult::Rejected;
+                                continue;
+                            }
+                        }
+
+                        queue.push(items[i]);
+                    }
+
+                    depth.store(queue.size());
+                }
+
+                dataEvent.notifyAll();
+
+                return result;
+            }
+
+
+            virtual size_t nextBatch(std::vector<shared_ptr<StageData>>& out, const size_t maxItems, const std::chrono::milliseconds& waitMs) override
+            {
+                if (maxItems == 0)
+                    return 0;
+
+                size_t taken = 0;
+
+                if (dataEvent.waitFor([this] { return depth.load() > 0 || closed.load(); }, waitMs, wake))
+                {
+                    std::scoped_lock lock(queueMux);
+
+                    for ( ; taken < maxItems && !queue.empty(); ++taken)
+                    {
+                        out.push_back(std::move(queue.front()));
+                        queue.pop();
+                    }
+
+                    depth.store(queue.size());
+                }
+
+                if (taken && capacity)
+                {
+                    spaceCV.notify_all();
+                    spaceEvent.notifyOne();
+                }
+
+                return taken;
+            }
+
+
+            virtual bool hasData() override
+            {
+                return depth.load() > 0;
+            }
+
+
+            virtual size_t queueSize() const override
+            {
+                return depth.load();
+            }
+
+
+            virtual void close() override
+            {
+                {
+                    std::scoped_lock lock(queueMux);
+                    closed = true;
+                }
+
+                spaceCV.notify_all();
+                spaceEvent.notifyAll();
+                dataEvent.notifyAll();
+            }
+
+
+            virtual bool dropsData() const override { return capacity && overflow != OverflowPolicy::Block; }
+
+
+            virtual bool notifyOnData(EventCount::Waiter& waiter) override
+            {
+                return dataEvent.waitAsync(waiter, [this] { return depth.load() > 0 || closed.load(); });
+            }
+
+
+            virtual bool full() const override
+            {
+                return capacity && overflow == OverflowPolicy::Block && depth.load() >= capacity;
+            }
+
+
+            virtual bool notifyOnSpace(EventCount::Waiter& waiter) override
+            {
+                return spaceEvent.waitAsync(waiter, [this] { return !full() || closed.load(); });
+            }
+
+            const size_t capacity;
+            const OverflowPolicy overflow;
+            const WakeStrategy wake;
+            std::atomic_bool closed;
+            std::queue<shared_ptr<StageData>> queue;
+            std::atomic_size_t depth;   ///< queue's size, so consumers can wait for data without the lock
+            mutable std::mutex queueMux;
+            std::condition_variable spaceCV;
+            EventCount spaceEvent;      ///< for notifyOnSpace(), producers which block use spaceCV
+            EventCount dataEvent;
+        };
+
+
+        /// Multi producer/multi consumer queue with a lane per priority, optionally bounded with a capacity > 0, 
+        /// so urgent items aren't queued behind bulk data.
+        ///
+        /// Data is taken from the highest priority lane with data, but each lane only weights[lane] times per round:
+        /// when every lane with data has had its share, a new round starts. So while all lanes are busy each gets
+        /// its weight's share of the takes, and lower priorities aren't starved. 
+        /// The capacity is the total over the lanes, OverflowPolicy::DropOldest drops from the lowest priority lane.
+        struct LaneQueue : public StageBuffer
+        {
+            LaneQueue(const std::vector<unsigned>& laneWeights, const size_t cap = 0, const OverflowPolicy policy = OverflowPolicy::Block, const WakeStrategy wakeStrategy = WakeStrategy::Block) 
+                : weights(laneWeights), credits(laneWeights), lanes(laneWeights.size()), size(0), 
+                  capacity(cap), overflow(policy), wake(wakeStrategy), closed(false), depth(0)
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override
+            {
+                BufferResult result = BufferResult::Added;
+
+                {
+                    std::unique_lock lock(queueMux);
+
+                    if (const auto r = push(d, lock); r != BufferResult::Added)
+                    {
+                        if (r != BufferResult::DroppedOldest)
+                            return r;
+
+                        result = r;
+                    }
+
+                    depth.store(size);
+                }
+
+                dataEvent.notifyOne();
+
+                return result;
+            }
+
+
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) override
+            {
+                shared_ptr<StageData> data;
+
+                if (dataEvent.waitFor([this] { return depth.load() > 0 || closed.load(); }, waitMs, wake))
+                {
+                    std::scoped_lock lock(queueMux);
+
+                    if (size)
+                    {
+                        data = take();
+                        depth.store(size);
+                    }
+                }
+
+                if (data && capacity)
+                {
+                    spaceCV.notify_one();
+                    spaceEvent.notifyOne();
+                }
+
+                return data;
+            }
+
+
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count) override
+            {
+                BufferResult result = BufferResult::Added;
+
+                {
+                    std::unique_lock lock(queueMux);
+
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        if (const auto r = push(items[i], lock); r == BufferResult::Closed)
+                            return r;
+                        else if (r != BufferResult::Added)
+                            result = r;
+                    }
+
+                    depth.store(size);
+                }
+
+                dataEvent.notifyAll();
+
+                return result;
+            }
+
+
+            virtual size_t nextBatch(std::vector<shared_ptr<StageData>>& out, const size_t maxItems, const std::chrono::milliseconds& waitMs) override
+            {
+                if (maxItems == 0)
+                    return 0;
+
+                size_t taken = 0;
+
+                if (dataEvent.waitFor([this] { return depth.load() > 0 || closed.load(); }, waitMs, wake))
+                {
+                    std::scoped_lock lock(queueMux);
+
+                    for ( ; taken < maxItems && size; ++taken)
+                    {
+                        out.push_back(take());
+                    }
+
+                    depth.store(size);
+                }
+
+                if (taken && capacity)
+                {
+                    spaceCV.notify_all();
+                    spaceEvent.notifyOne();
+                }
+
+                return taken;
+            }
+
+
+            virtual bool hasData() override
+            {
+                return depth.load() > 0;
+            }
+
+
+            virtual size_t queueSize() const override
+            {
+                return depth.load();
+            }
+
+
+            virtual void close() override
+            {
+                {
+                    std::scoped_lock lock(queueMux);
+                    closed = true;
+                }
+
+                spaceCV.notify_all();
+                spaceEvent.notifyAll();
+                dataEvent.notifyAll();
+            }
+
+
+            virtual bool dropsData() const override { return capacity && overflow != OverflowPolicy::Block; }
+
+
+            virtual bool notifyOnData(EventCount::Waiter& waiter) override
+            {
+                return dataEvent.waitAsync(waiter, [this] { return depth.load() > 0 || closed.load(); });
+            }
+
+
+            virtual bool full() const override
+            {
+                return capacity && overflow == OverflowPolicy::Block && depth.load() >= capacity;
+            }
+
+
+            virtual bool notifyOnSpace(EventCount::Waiter& waiter) override
+            {
+                return spaceEvent.waitAsync(waiter, [this] { return !full() || closed.load(); });
+            }
+
+
+            /// Adds to d's lane, applying the overflow policy. Lock queueMux.
+            BufferResult push(const shared_ptr<StageData>& d, std::unique_lock<std::mutex>& lock)
+            {
+                BufferResult result = BufferResult::Added;
+
+                if (closed)
+                    return BufferResult::Closed;
+
+                if (capacity && size >= capacity)
+                {
+                    switch (overflow)
+                    {
+                    case OverflowPolicy::Block:
+                        // let the consumer see what's been added before waiting for it to make space
+                        depth.store(size);
+                        dataEvent.notifyAll();
+                        spaceCV.wait(lock, [this] { return size < capacity || closed; });
+                        if (closed)
+                            return BufferResult::Closed;
+                        break;
+
+                    case OverflowPolicy::DropOldest:
+                        for (auto& lane : lanes)
+                        {
+                            if (!lane.empty())
+                            {
+                                lane.pop_front();
+                                --size;
+                                break;
+                            }
+                        }
+                        result = BufferResult::DroppedOldest;
+                        break;
+
+                    case OverflowPolicy::DropNewest:
+                        return BufferResult::DroppedNewest;
+
+                    default:
+                        return BufferResult::Rejected;
+                    }
+                }
+
+                lanes[std::min<size_t>(d->priority(), lanes.size() - 1U)].push_back(d);
+                ++size;
+
+                return result;
+            }
+
+
+            /// Takes the next item by priority and weight. Lock queueMux, there must be data.
+            shared_ptr<StageData> take()
+            {
+                while (true)
+                {
+                    for (size_t lane = lanes.size(); lane-- > 0; )
+                    {
+                        if (!lanes[lane].empty() && credits[lane] > 0)
+                        {
+                            --credits[lane];
+                            --size;
+
+                            shared_ptr<StageData> data = std::move(lanes[lane].front());
+                            lanes[lane].pop_front();
+                            return data;
+                        }
+                    }
+
+                    // every lane with data has had its share this round
+                    credits = weights;
+                }
+            }
+
+            const std::vector<unsigned> weights;
+            std::vector<unsigned> credits;      ///< takes left this round, per lane
+            std::vector<std::deque<shared_ptr<StageData>>> lanes;   ///< lowest priority first
+            size_t size;
+
+            const size_t capacity;
+            const OverflowPolicy overflow;
+            const WakeStrategy wake;
+            std::atomic_bool closed;
+            std::atomic_size_t depth;   ///< size, so consumers can wait for data without the lock
+            mutable std::mutex queueMux;
+            std::condition_variable spaceCV;
+            EventCount spaceEvent;      ///< for notifyOnSpace(), producers which block use spaceCV
+            EventCount dataEvent;
+        };
+
+
+        /// Multi producer/multi consumer queue which never blocks producers or drops data: up to capacity items are
+        /// kept in memory, further items are serialized to memory mapped segment files and read back, in order,
+        /// as the consumer catches up. For bursts larger than RAM, i.e. while a downstream stage is stalled.
+        ///
+        /// Once anything is spilled, new items are spilled too until the consumer has read them all back, so items
+        /// leave in the order they arrived. Drained segments are reused or deleted.
+        /// add() returns BufferResult::Rejected if a segment file can't be created. Spilled data which can't be read back is
+        /// logged and dropped.
+        struct SpillQueue : public StageBuffer
+        {
+            SpillQueue(const size_t cap, const SpillConfig& spillConfig, const WakeStrategy wakeStrategy = WakeStrategy::Block) 
+                : capacity(cap), config(spillConfig), wake(wakeStrategy), closed(false), depth(0), spilled(0), spilling(0)
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override
+            {
+                {
+                    std::unique_lock lock(queueMux);
+
+                    if (closed)
+                        return BufferResult::Closed;
+
+                    if (spilled + spilling == 0 && memory.size() < capacity)
+                    {
+                        memory.push(d);
+                        depth.store(memory.size() + spilled);
+                    }
+                    else
+                    {
+                        // serialize without the lock, later items spill too so they can't overtake this one
+                        ++spilling;
+                        lock.unlock();
+
+                        thread_local std::vector<char> bytes;
+                        const StageData::Stamps stamps = d->stamps();
+
+                        bytes.assign(reinterpret_cast<const char*>(&stamps), reinterpret_cast<const char*>(&stamps) + sizeof(stamps));
+                        config.serialize(*d, bytes);
+
+                        lock.lock();
+                        --spilling;
+
+                        if (closed)
+                            return BufferResult::Closed;
+
+                        if (!spill(bytes))
+                            return BufferResult::Rejected;
+
+                        ++spilled;
+                        depth.store(memory.size() + spilled);
+                    }
+                }
+
+                dataEvent.notifyOne();
+
+                return BufferResult::Added;
+            }
+
+
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) override
+            {
+                thread_local std::vector<char> bytes;
+
+                if (dataEvent.waitFor([this] { return depth.load() > 0 || closed.load(); }, waitMs, wake))
+                {
+                    std::scoped_lock lock(queueMux);
+
+                    if (!memory.empty())
+                    {
+                        auto data = std::move(memory.front());
+                        memory.pop();
+                        depth.store(memory.size() + spilled);
+                        return data;
+                    }
+
+                    if (!spilled)
+                        return nullptr;
+
+                    if (!readBack(bytes))
+                    {
+                        logg("SpillQueue: can't read back spilled data, dropping " + std::to_string(spilled) + " items");
+                        discardSpilled();
+                        return nullptr;
+                    }
+
+                    --spilled;
+                    depth.store(memory.size() + spilled);
+                }
+                else
+                {
+                    return nullptr;
+                }
+
+                // deserialized without the lock
+                StageData::Stamps stamps;
+                std::memcpy(&stamps, bytes.data(), sizeof(stamps));
+
+                auto data = config.deserialize(bytes.data() + sizeof(stamps), bytes.size() - sizeof(stamps));
+
+                if (data)
+                    data->restoreStamps(stamps);
+                else
+                    logg("SpillQueue: deserialize failed, item dropped");
+
+                return data;
+            }
+
+
+            virtual bool hasData() override
+            {
+                return depth.load() > 0;
+            }
+
+
+            virtual size_t queueSize() const override
+            {
+                return depth.load();
+            }
+
+
+            virtual void close() override
+            {
+                {
+                    std::scoped_lock lock(queueMux);
+                    closed = true;
+                }
+
+                dataEvent.notifyAll();
+            }
+
+
+            virtual bool notifyOnData(EventCount::Waiter& waiter) override
+            {
+                return dataEvent.waitAsync(waiter, [this] { return depth.load() > 0 || closed.load(); });
+            }
+
+
+            /// Appends to the last segment, starting another if it's full. Lock queueMux.
+            bool spill(const std::vector<char>& bytes)
+            {
+                if (!segments.empty() && segments.back()->append(bytes.data(), bytes.size()))
+                    return true;
+
+                try
+                {
+                    const size_t size = std::max(config.segmentSize, SpillSegment::recordSize(bytes.size()));
+
+                    if (!spare.empty() && spare.back()->capacity() >= size)
+                    {
+                        segments.push_back(std::move(spare.back()));
+                        spare.pop_back();
+                    }
+                    else
+                    {
+                        segments.push_back(std::make_unique<SpillSegment>(config.directory, size));
+                    }
+                }
+                catch (const std::exception&)
+                {
+                    return false;
+                }
+
+                return segments.back()->append(bytes.data(), bytes.size());
+            }
+
+
+            /// Reads the oldest spilled item, recycling segments once they're drained. Returns false if there's nothing 
+            /// to read or the record is corrupt. Lock queueMux.
+            bool readBack(std::vector<char>& bytes)
+            {
+                while (!segments.empty())
+                {
+                    const bool read = segments.front()->read(bytes);
+
+                    if (!read && !segments.front()->drained())
+                        return false;
+
+                    if (segments.front()->drained())
+                    {
+                        segments.front()->reset();
+
+                        if (spare.size() < config.spareSegments)
+                            spare.push_back(std::move(segments.front()));
+
+                        segments.pop_front();
+                    }
+
+                    if (read)
+                        return true;
+                }
+
+                return false;
+            }
+
+
+            /// For when spilled data can't be read back: the rest are lost, since what follows can't be found or 
+            /// would leave out of order. Lock queueMux.
+            void discardSpilled()
+            {
+                segments.clear();
+                spilled = 0;
+                depth.store(memory.size());
+            }
+
+            const size_t capacity;
+            const SpillConfig config;
+            const WakeStrategy wake;
+            std::atomic_bool closed;
+            std::queue<shared_ptr<StageData>> memory;   ///< older than anything spilled
+            std::atomic_size_t depth;                   ///< in memory and spilled, so consumers can wait for data without the lock
+            size_t spilled;
+            size_t spilling;                            ///< being serialized by producers
+            std::deque<std::unique_ptr<SpillSegment>> segments;     ///< oldest first, appended to the last
+            std::vector<std::unique_ptr<SpillSegment>> spare;
+            mutable std::mutex queueMux;
+            EventCount dataEvent;
+        };
+
+
+        /// Bounded, lock free ring buffer for a single producer (the previous stage) and 
+        /// a single consumer (this stage's run()). Only use when exactly one thread calls add()
+        /// and exactly one thread calls next().
+        /// 
+        /// The capacity is rounded up to a power of two. When full with OverflowPolicy::Block, add() waits, 
+        /// as the consumer does for data, until the consumer frees a slot or the buffer is closed. 
+        /// OverflowPolicy::DropOldest is not supported because only the consumer may advance the head.
+        ///
+        /// The producer and consumer indices are on separate cache lines, each side keeping a cached
+        /// copy of the other's index so the shared index is only re-read when the ring appears full/empty.
+        /// Neither side makes a syscall unless the other is parked.
+        struct RingBuffer : public StageBuffer
+        {
+            static const size_t CacheLineSize = 64U;
+
+
+            RingBuffer(const size_t capacity, const OverflowPolicy policy = OverflowPolicy::Block, const WakeStrategy wakeStrategy = WakeStrategy::Block) : 
+                                                slots(roundUpPowerOfTwo(capacity)), mask(slots.size() - 1U), overflow(policy), wake(wakeStrategy),
+                                                head(0), cachedTail(0), tail(0), cachedHead(0), closed(false)
+            {
+
+            }
+
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override
+            {
+                const size_t t = tail.load(std::memory_order_relaxed);
+
+                if (const auto result = waitForSpace(t); result != BufferResult::Added)
+                    return result;
+
+                slots[t & mask] = d;
+                publish(t + 1U);
+
+                return BufferResult::Added;
+            }
+
+
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count) override
+            {
+                size_t t = tail.load(std::memory_order_relaxed);
+
+                for (size_t i = 0; i < count; )
+                {
+                    if (const auto result = waitForSpace(t); result != BufferResult::Added)
+                    {
+                        // publish what we have, the remaining items are dropped/rejected
+                        publish(t);
+                        return result;
+                    }
+
+                    // fill what's free then publish once, rather than per item
+                    for (const size_t end = cachedHead + slots.size(); i < count && t != end; ++i, ++t)
+                    {
+                        slots[t & mask] = items[i];
+                    }
+
+                    publish(t);
+                }
+
+                return BufferResult::Added;
+            }
+
+
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) override
+            {
+                shared_ptr<StageData> data;
+
+                const size_t h = head.load(std::memory_order_relaxed);
+
+                if (waitForData(h, waitMs))
+                {
+                    data = std::move(slots[h & mask]);
+                    release(h + 1U);
+                }
+
+                return data;
+            }
+
+
+            virtual size_t nextBatch(std::vector<shared_ptr<StageData>>& out, const size_t maxItems, const std::chrono::milliseconds& waitMs) override
+            {
+                if (maxItems == 0)
+                    return 0;
+
+                const size_t h = head.load(std::memory_order_relaxed);
+                const size_t count = std::min(waitForData(h, waitMs), maxItems);
+
+                for (size_t i = 0; i < count; ++i)
+                {
+                    out.push_back(std::move(slots[(h + i) & mask]));
+                }
+
+                if (count)
+                {
+                    release(h + count);
+                }
+
+                return count;
+            }
+
+
+            virtual bool hasData() override
+            {
+                return tail.load(std::memory_order_acquire) != head.load(std::memory_order_acquire);
+            }
+
+
+            virtual size_t queueSize() const override
+            {
+                const size_t h = head.load(std::memory_order_acquire);
+                return tail.load(std::memory_order_acquire) - h;
+            }
+
+
+            virtual bool multiProducer() const override { return false; }
+            virtual bool multiConsumer() const override { return false; }
+            virtual bool dropsData() const override { return overflow != OverflowPolicy::Block; }
+
+
+            virtual void close() override
+            {
+                closed.store(true);
+                dataEvent.notifyAll();
+                spaceEvent.notifyAll();
+            }
+
+
+            virtual void localise() override
+            {
+                // the slots are written by both sides, so put them with the consumer
+                if (head.load() == tail.load())
+                    std::vector<shared_ptr<StageData>>(slots.size()).swap(slots);
+            }
+
+
+            virtual bool notifyOnData(EventCount::Waiter& waiter) override
+            {
+                return dataEvent.waitAsync(waiter, [this] { return hasData() || closed.load(); });
+            }
+
+
+            virtual bool full() const override
+            {
+                return overflow == OverflowPolicy::Block && queueSize() >= slots.size();
+            }
+
+
+            virtual bool notifyOnSpace(EventCount::Waiter& waiter) override
+            {
+                return spaceEvent.waitAsync(waiter, [this] { return !full() || closed.load(); });
+            }
+
+
+            /// Producer: returns Added when slot t is free, otherwise the overflow result.
+            BufferResult waitForSpace(const size_t t)
+            {
+                if (closed.load())
+                    return BufferResult::Closed;
+
+                while (t - cachedHead >= slots.size())
+                {
+                    cachedHead = head.load(std::memory_order_acquire);
+
+                    if (t - cachedHead >= slots.size())
+                    {
+                        if (overflow == OverflowPolicy::DropNewest)
+                            return BufferResult::DroppedNewest;
+                        else if (overflow != OverflowPolicy::Block)
+                            return BufferResult::Rejected;
+                        else if (closed.load())
+                            return BufferResult::Closed;
+
+                        // parks with the consumer's wake strategy, so a slow consumer doesn't cost a core
+                        spaceEvent.waitFor([this, t] { return t - head.load() < slots.size() || closed.load(); }, 100ms, wake);
+                    }
+                }
+
+                return BufferResult::Added;
+            }
+
+
+            /// Producer: makes slots up to newTail visible to the consumer.
+            void publish(const size_t newTail)
+            {
+                if (newTail == tail.load(std::memory_order_relaxed))
+                    return;
+
+                tail.store(newTail, std::memory_order_release);
+                dataEvent.notifyOne();
+            }
+
+
+            /// Consumer: frees the slots before newHead for the producer.
+            void release(const size_t newHead)
+            {
+                head.store(newHead, std::memory_order_release);
+
+                if (overflow == OverflowPolicy::Block)
+                    spaceEvent.notifyOne();
+            }
+
+
+            /// Consumer: returns the number of items available from h, waiting up to waitMs if there are none.
+            size_t waitForData(const size_t h, const std::chrono::milliseconds& waitMs)
+            {
+                if (cachedTail == h)
+                {
+                    cachedTail = tail.load(std::memory_order_acquire);
+
+                    if (cachedTail == h && waitMs.count() > 0)
+                    {
+                        dataEvent.waitFor([this, h] { return tail.load() != h || closed.load(); }, waitMs, wake);
+                        cachedTail = tail.load(std::memory_order_acquire);
+                    }
+                }
+
+                return cachedTail - h;
+            }
+
+
+            static size_t roundUpPowerOfTwo(const size_t n)
+            {
+                size_t p = 2U;
+                while (p < n)
+                    p <<= 1U;
+                return p;
+            }
+
+
+            std::vector<shared_ptr<StageData>> slots;
+            const size_t mask;
+            const OverflowPolicy overflow;
+            const WakeStrategy wake;
+
+            // consumer side
+            alignas(CacheLineSize) std::atomic_size_t head;
+            size_t cachedTail;
+
+            // producer side
+            alignas(CacheLineSize) std::atomic_size_t tail;
+            size_t cachedHead;
+
+            alignas(CacheLineSize) std::atomic_bool closed;
+            EventCount dataEvent;
+            EventCount spaceEvent;      ///< producer waiting with OverflowPolicy::Block
+        };
+
+
+        /// Base for buffers which add behaviour to another buffer, passing everything else through.
+        struct BufferDecorator : public StageBuffer
+        {
+            BufferDecorator(const shared_ptr<StageBuffer>& b) : inner(b)
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override { return inner->add(d); }
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds& waitMs) override { return inner->next(waitMs); }
+            virtual bool hasData() override { return inner->hasData(); }
+            virtual size_t queueSize() const override { return inner->queueSize(); }
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count) override { return inner->addBatch(items, count); }
+            virtual size_t nextBatch(std::vector<shared_ptr<StageData>>& out, const size_t maxItems, const std::chrono::milliseconds& waitMs) override { return inner->nextBatch(out, maxItems, waitMs); }
+            virtual void close() override { inner->close(); }
+            virtual void localise() override { inner->localise(); }
+            virtual bool notifyOnData(EventCount::Waiter& waiter) override { return inner->notifyOnData(waiter); }
+            virtual bool notifyOnSpace(EventCount::Waiter& waiter) override { return inner->notifyOnSpace(waiter); }
+            virtual bool full() const override { return inner->full(); }
+            virtual bool multiProducer() const override { return inner->multiProducer(); }
+            virtual bool multiConsumer() const override { return inner->multiConsumer(); }
+            virtual bool dropsData() const override { return inner->dropsData(); }
+
+            shared_ptr<StageBuffer> inner;
+        };
+
+
+        /// Input of an ordered, replicated stage: numbers data in the order it arrives, from 1.
+        struct SequenceBuffer : public BufferDecorator
+        {
+            SequenceBuffer(const shared_ptr<StageBuffer>& b) : BufferDecorator(b), nextSequence(1)
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override
+            {
+                d->sequence(nextSequence++);
+                return inner->add(d);
+            }
+
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count) override
+            {
+                const uint64_t first = nextSequence.fetch_add(count);
+
+                for (size_t i = 0; i < count; ++i)
+                {
+                    items[i]->sequence(first + i);
+                }
+
+                return inner->addBatch(items, count);
+            }
+
+            std::atomic_uint64_t nextSequence;
+        };
+
+
+        /// Output of an ordered, replicated stage, shared by all replicas: passes data to the next stage in the order
+        /// of the inputs it came from. Data for the oldest input which isn't complete() goes straight through, data for
+        /// later inputs is held until every input before them is complete. So a replica may pass on any number of items
+        /// for an input, including none, and new objects, see PipelineStage::dataComplete().
+        /// Data without a sequence number is rejected, it would otherwise be held forever.
+        struct ReorderBuffer : public BufferDecorator
+        {
+            ReorderBuffer(const shared_ptr<StageBuffer>& b) : BufferDecorator(b), nextSequence(1)
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override
+            {
+                std::scoped_lock lock(reorderMux);
+                return reorder(d);
+            }
+
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count) override
+            {
+                BufferResult result = BufferResult::Added;
+
+                std::scoped_lock lock(reorderMux);
+
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if (const auto r = reorder(items[i]); r != BufferResult::Added)
+                        result = r;
+                }
+
+                return result;
+            }
+
+            /// Only one replica at a time adds to the next stage's buffer.
+            virtual bool multiProducer() const override { return true; }
+
+            virtual void complete(const uint64_t sequence) override
+            {
+                std::scoped_lock lock(reorderMux);
+
+                if (sequence < nextSequence)
+                    return;
+
+                completed.insert(sequence);
+
+                // the next input is now the oldest, pass on what it has sent so far
+                while (completed.erase(nextSequence))
+                {
+                    ++nextSequence;
+
+                    const auto held = pending.equal_range(nextSequence);
+
+                    for (auto it = held.first; it != held.second; ++it)
+                    {
+                        inner->add(it->second);
+                    }
+
+                    pending.erase(held.first, held.second);
+                }
+            }
+
+            BufferResult reorder(const shared_ptr<StageData>& d)
+            {
+                const uint64_t sequence = d->sequence();
+
+                if (sequence == 0)
+                    return BufferResult::Rejected;
+
+                if (sequence > nextSequence)
+                {
+                    pending.emplace(sequence, d);
+                    return BufferResult::Added;
+                }
+
+                return inner->add(d);
+            }
+
+            uint64_t nextSequence;      ///< the oldest input which isn't complete
+            std::multimap<uint64_t, shared_ptr<StageData>> pending;     ///< by input, in the order sent
+            std::set<uint64_t> completed;                               ///< inputs after nextSequence which are complete
+            std::mutex reorderMux;
+        };
+
+
+        /// Output to a sharded stage: adds each item to the buffer of the shard for its key.
+        /// It is never read from, each shard takes from its own buffer.
+        struct ShardBuffer : public StageBuffer
+        {
+            ShardBuffer(std::vector<shared_ptr<StageBuffer>>&& shardBuffers, KeyExtractor keyExtractor) : shards(std::move(shardBuffers)), key(std::move(keyExtractor))
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override 
+            { 
+                return shards[shardFor(key(*d), shards.size())]->add(d);
+            }
+
+            virtual BufferResult addBatch(const shared_ptr<StageData>* items, const size_t count) override
+            {
+                BufferResult result = BufferResult::Added;
+
+                // local rather than shared, replicas may share this output and a shard's addBatch() may add to it again
+                std::vector<std::vector<shared_ptr<StageData>>> batches(shards.size());
+
+                for (size_t i = 0; i < count; ++i)
+                {
+                    batches[shardFor(key(*items[i]), shards.size())].push_back(items[i]);
+                }
+
+                for (size_t shard = 0; shard < shards.size(); ++shard)
+                {
+                    if (!batches[shard].empty())
+                    {
+                        if (const auto r = shards[shard]->addBatch(batches[shard].data(), batches[shard].size()); r != BufferResult::Added)
+                            result = r;
+                    }
+                }
+
+                return result;
+            }
+
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds&) override { return nullptr; }
+            
+            virtual bool hasData() override 
+            { 
+                return std::any_of(shards.begin(), shards.end(), [](auto& shard) { return shard->hasData(); });
+            }
+
+            virtual size_t queueSize() const override
+            {
+                size_t size = 0;
+                for (auto& shard : shards)
+                    size += shard->queueSize();
+                return size;
+            }
+
+            virtual bool multiProducer() const override { return shards.front()->multiProducer(); }
+
+            virtual bool full() const override
+            {
+                return std::any_of(shards.begin(), shards.end(), [](auto& shard) { return shard->full(); });
+            }
+
+            virtual bool notifyOnSpace(EventCount::Waiter& waiter) override
+            {
+                auto full = std::find_if(shards.begin(), shards.end(), [](auto& shard) { return shard->full(); });
+                return full != shards.end() && (*full)->notifyOnSpace(waiter);
+            }
+
+            std::vector<shared_ptr<StageBuffer>> shards;
+            KeyExtractor key;
+        };
+
+
+        /// Input of a fused stage: add() passes the item straight to the stage's process(), on the calling thread.
+        /// It is never read from. See Pipeline::fuse().
+        struct FusedBuffer : public StageBuffer
+        {
+            FusedBuffer(PipelineStage& fusedStage) : stage(fusedStage)
+            {
+
+            }
+
+            virtual BufferResult add(const shared_ptr<StageData>& d) override { return stage.processFused(d); }
+            virtual shared_ptr<StageData> next(const std::chrono::milliseconds&) override { return nullptr; }
+            virtual bool hasData() override { return false; }
+            virtual size_t queueSize() const override { return 0U; }
+
+            /// The stage's counters are updated by whichever thread calls add(), so only one may.
+            virtual bool multiProducer() const override { return false; }
+            virtual bool multiConsumer() const override { return false; }
+
+            PipelineStage& stage;
+        };
+
+
+    protected:        
+        enum PauseState { Requested, Paused, PauseEnd };
+
+
+        /// bufferCapacity applies to bounded buffer types (BufferType::RingBuffer) only.
+        PipelineStage(const string& name = "", const BufferType buffType = BufferType::Queue, const size_t bufferCapacity = DefaultBufferCapacity);
+        
+        /// Throws std::runtime_error if the config is not valid for the buffer type.
+        PipelineStage(const string& name, const BufferConfig& bufferConfig);
+        virtual ~PipelineStage();
+
+
+        bool isPauseRequested() const;
+        void enterPause();
+
+
+    public:
+
+        const string& name() const { return m_name; }
+        StageId id() const { return m_id; }
+
+        virtual void initialise(const StageId id, const shared_ptr<Poco::NotificationCenter>& nc);
+
+        /// Adds next as an output: dataComplete() adds directly to the next stage's buffer. 
+        /// The notification center is only used for control.
+        ///
+        /// If ordered, this stage's input must be sequenced (sequenceInput()) and data reaches next in the 
+        /// order it arrived at this stage, via a ReorderBuffer. Other replicas then use shareOutputs().
+        void connect(PipelineStage& next, const bool ordered = false);
+
+        /// Adds next as an output which is called directly: dataComplete() calls next's process() on this stage's thread
+        /// instead of adding to next's buffer. next must be fusable(). See Pipeline::fuse().
+        void connectFused(PipelineStage& next, const bool ordered = false);
+
+        /// Adds the shards of a sharded stage as one output, each item going to shards[shardFor(key(item))].
+        void connect(const std::vector<shared_ptr<PipelineStage>>& shards, KeyExtractor key, const bool ordered = false);
+
+        /// For replicas: take data from primary's input buffer.
+        void shareInput(const PipelineStage& primary) 
+        { 
+            m_data = primary.m_data; 
+            m_sequenced = primary.m_sequenced;
+        }
+
+        /// For replicas: send data to the same outputs as primary, so they share the ReorderBuffers.
+        void shareOutputs(const PipelineStage& primary);
+
+        /// Number data as it arrives, so an ordered output can restore the order.
+        void sequenceInput();
+
+        /// For ordered stages: tells the outputs the stage has passed on everything for the inputs it has taken. 
+        /// Called as the stage takes more data, and by the pipeline when run() returns.
+        void completeInputs()
+        {
+            if (!m_inputSequences.empty())
+                completeSequences();
+        }
+
+        /// If set, each item goes to the output chosen by the router, rather than all outputs.
+        void setRouter(Router router) { m_router = std::move(router); }
+
+        /// Reallocates the input buffer's storage from the calling thread, see Pipeline::setPlacement().
+        void localiseBuffer() { m_data->localise(); }
+
+        /// Called on the stage's thread before run(), after the thread is pinned by the pipeline's placement.
+        /// Allocate large stage owned memory here or in run(), rather than in the constructor, so it's on 
+        /// the NUMA node the stage runs on.
+        virtual void initialiseThread() {}
+
+        bool acceptsMultipleProducers() const { return m_data->multiProducer(); }
+        bool acceptsMultipleConsumers() const { return m_data->multiConsumer(); }
+        bool mayDropData() const { return m_data->dropsData(); }
+
+        virtual void run() = 0;
+
+        virtual void stopStage();
+
+        /// Stops this instance's run() without closing its input buffer, which replicas share.
+        void stopInstance();
+
+        /// True for stages which can be fused with the stage before them, i.e. TransformStage, which handle one item 
+        /// at a time in process() rather than taking data in run().
+        virtual bool fusable() const { return false; }
+
+        /// False for stages which don't need a thread of their own, i.e. CoroutineStage. Pipeline calls their 
+        /// startDetached(), which returns a future that is ready when the stage has finished, rather than run().
+        virtual bool needsThread() const { return true; }
+        virtual std::shared_future<void> startDetached() { return {}; }
+
+        /// The executor of the stage's pipeline, if it has one, for stages which run on an executor, and parallelFor().
+        virtual void setExecutor(const shared_ptr<Executor>& executor) { m_parallelExecutor = executor; }
+
+        /// Data entering the pipeline through this stage, by injectData(), or dataComplete() if the stage has no inputs, 
+        /// waits for or is refused by budget. See Pipeline::setMemoryBudget().
+        void setMemoryBudget(const shared_ptr<MemoryBudget>& budget) { m_budget = budget; }
+
+        /// Returns BufferResult::Rejected, or BufferResult::Closed if the pipeline is stopping, if the memory budget refuses the data.
+        /// Null data is rejected.
+        BufferResult injectData(const shared_ptr<StageData>& data);
+
+        void handleStageCommand(const Poco::AutoPtr<StageCommand>& pNf);
+        void handleStageNotification(const Poco::AutoPtr<PipelineStageControlNotification>& notification);
+
+
+        size_t queueSize() const { return m_data->queueSize(); }
+
+        /// Can be called from any thread while the stage runs.
+        StageMetrics metrics() const;
+
+        /// Time data spent in this stage's input buffer, from being added to being taken.
+        LatencySnapshot dwellLatency() const { return m_dwell.snapshot(); }
+
+        /// For a stage with no outputs, time from data entering the pipeline until this stage took it.
+        LatencySnapshot endToEndLatency() const { return m_endToEnd.snapshot(); }
+
+        bool hasOutputs() const { return !m_outputs.empty(); }
+
+    protected:
+
+        bool shouldStop();
+
+
+        /// Handles one item, for fusable() stages. Called by their run() or, when fused, the previous stage's dataComplete().
+        virtual void process(shared_ptr<StageData>&&) {}
+
+        /// Calls body(i) for each i in [0, count) in parallel and returns when all have returned, so a stage can use all
+        /// cores on one large item without replicas, i.e. one index per chunk before dataComplete(). Runs on the
+        /// pipeline's executor, otherwise Executor::shared(), and this thread. See Executor::parallelFor().
+        void parallelFor(const size_t count, const std::function<void(size_t)>& body);
+
+        /// For stages which mustn't block their thread, see StageBuffer::notifyOnData().
+        bool notifyOnData(EventCount::Waiter& waiter) { return m_data->notifyOnData(waiter); }
+
+        /// True if dataComplete(data) would wait for space in a next stage's buffer.
+        bool outputFull(const StageData& data) const;
+
+        /// For stages which mustn't block their thread: arranges for waiter.wake() to be called once, when the output
+        /// dataComplete(data) would wait for may have space. Returns false as StageBuffer::notifyOnSpace().
+        bool notifyOnSpace(const StageData& data, EventCount::Waiter& waiter);
+
+        /// For stages which wait for data other than in nextData(), so the time is counted as waiting rather than busy.
+        void addWaitTime(const std::chrono::nanoseconds& waited)
+        {
+            addTo(m_waitNs, static_cast<uint64_t>(waited.count()));
+            m_idleSinceTake += waited;
+        }
+
+
+        /// Passes data to the next stage(s). With OverflowPolicy::Block this waits while a next stage's buffer is full.
+        /// Returns BufferResult::Rejected if this stage has no outputs or the router returns an invalid output.
+        ///
+        /// When sent to multiple outputs, each receives the same object, so consumers must not modify it.
+        BufferResult dataComplete(shared_ptr<StageData>&& data)
+        {
+            const auto start = std::chrono::steady_clock::now();
+
+            if (data)
+            {
+                if (m_budget && !data->chargeBudget(m_budget, isSource()))
+                    return refusedByBudget();
+
+                if (m_sequenced)
+                    sequenceOutput(*data);
+
+                data->stampInjected(injectTimeOfOutput(start));
+                data->stampEnqueued(start);
+            }
+
+            const auto result = (m_outputs.size() == 1U && !m_router) ? m_outputs.front()->add(data) : forward(data);
+            
+            endForward(start, 1U);
+
+            return result;
+        }
+
+
+        template<class DataT = StageData>
+        shared_ptr<DataT> nextData(const std::chrono::milliseconds& waitMs = 100ms)
+        {
+            completeInputs();
+
+            const auto start = beginTake();
+
+            auto data = m_data->next(waitMs);
+
+            endTake(start, data ? 1U : 0U);
+
+            if (data)
+                recordLatency(*data);
+
+            return std::dynamic_pointer_cast<DataT>(std::move(data));
+        }
+
+
+        shared_ptr<StageData> nextData(const std::chrono::milliseconds& waitMs = 100ms)
+        {
+            return nextData<>(waitMs);
+        }
+
+
+        /// Takes up to maxItems in one lock/wakeup, waiting up to waitMs if there's no data.
+        /// Items which are not a DataT are discarded, as nextData<DataT>() would return nullptr for them.
+        template<class DataT = StageData>
+        size_t nextBatch(std::vector<shared_ptr<DataT>>& out, const size_t maxItems, const std::chrono::milliseconds& waitMs = 100ms)
+        {
+            completeInputs();
+
+            if constexpr (std::is_same_v<DataT, StageData>)
+            {
+                const auto start = beginTake();
+                const size_t count = m_data->nextBatch(out, maxItems, waitMs);
+                endTake(start, count);
+
+                for (size_t i = out.size() - count; i < out.size(); ++i)
+                    recordLatency(*out[i]);
+
+                return count;
+            }
+            else
+            {
+                m_batchIn.clear();
+
+                const auto start = beginTake();
+                endTake(start, m_data->nextBatch(m_batchIn, maxItems, waitMs));
+
+                for (auto& data : m_batchIn)
+                    recordLatency(*data);
+
+                const size_t outSize = out.size();
+
+                for (auto& data : m_batchIn)
+                {
+                    if (auto d = std::dynamic_pointer_cast<DataT>(data); d)
+                        out.push_back(std::move(d));
+                }
+
+                m_batchIn.clear();
+
+                return out.size() - outSize;
+            }
+        }
+
+
+        template<class DataT = StageData>
+        std::vector<shared_ptr<DataT>> nextBatch(const size_t maxItems, const std::chrono::milliseconds& waitMs = 100ms)
+        {
+            std::vector<shared_ptr<DataT>> batch;
+            nextBatch<DataT>(batch, maxItems, waitMs);
+            return batch;
+        }
+
+
+        /// Passes a range of shared_ptr<StageData> (or derived) to the next stage in a single add.
+        template<class Range, class = std::enable_if_t<!std::is_convertible_v<const Range&, shared_ptr<StageData>>>>
+        BufferResult dataComplete(const Range& batch)
+        {
+            m_batchOut.assign(std::begin(batch), std::end(batch));
+
+            const auto start = std::chrono::steady_clock::now();
+            BufferResult refused = BufferResult::Added;
+
+            if (m_budget)
+            {
+                // items entering the pipeline which the budget refuses aren't sent
+                m_batchOut.erase(std::remove_if(m_batchOut.begin(), m_batchOut.end(), [this, &refused](const shared_ptr<StageData>& data) 
+                {
+                    if (data->chargeBudget(m_budget, isSource()))
+                        return false;
+
+                    refused = refusedByBudget();
+                    return true;
+                }), m_batchOut.end());
+            }
+
+            for (auto& data : m_batchOut)
+            {
+                if (m_sequenced)
+                    sequenceOutput(*data);
+
+                data->stampInjected(injectTimeOfOutput(start));
+                data->stampEnqueued(start);
+            }
+
+            auto result = forwardBatch(m_batchOut);
+
+            if (refused != BufferResult::Added)
+                result = refused;
+
+            endForward(start, m_batchOut.size());
+
+            m_batchOut.clear();
+
+            return result;
+        }
+
+
+    protected:
+        using Clock = std::chrono::steady_clock;
+
+        /// Counters are only written by the stage's own thread, so they're updated with a load and store 
+        /// rather than a locked read-modify-write. Other threads only read them, in metrics().
+        static void addTo(std::atomic_uint64_t& counter, const uint64_t n)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+
+        Clock::time_point beginTake()
+        {
+            const auto now = Clock::now();
+
+            if (m_lastTake != Clock::time_point{})
+            {
+                const auto busy = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_lastTake) - m_idleSinceTake;
+                addTo(m_busyNs, static_cast<uint64_t>(std::max<int64_t>(busy.count(), 0)));
+            }
+
+            // with a single consumer, the depth only grows between takes so this sees the peak
+            if (const size_t depth = m_data->queueSize(); depth > m_peakDepth.load(std::memory_order_relaxed))
+                m_peakDepth.store(depth, std::memory_order_relaxed);
+
+            return now;
+        }
+
+
+        void endTake(const Clock::time_point& start, const size_t count)
+        {
+            m_lastTake = Clock::now();
+            m_idleSinceTake = std::chrono::nanoseconds::zero();
+
+            addTo(m_waitNs, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(m_lastTake - start).count()));
+            addTo(m_itemsIn, count);
+        }
+
+
+        /// For each item taken from the buffer.
+        void recordLatency(StageData& data)
+        {
+            data.releaseBudget();
+
+            if (m_sequenced)
+                m_inputSequences.push_back(data.sequence());
+
+            m_inputInjectTime = data.injectTime();
+
+            m_dwell.record(m_lastTake - data.enqueueTime());
+
+            if (m_outputs.empty())
+                m_endToEnd.record(m_lastTake - data.injectTime());
+        }
+
+
+        void endForward(const Clock::time_point& start, const size_t count)
+        {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+
+            m_idleSinceTake += elapsed;
+
+            addTo(m_forwardNs, static_cast<uint64_t>(elapsed.count()));
+            addTo(m_itemsOut, count);
+        }
+
+
+    private:
+        void addOutput(const shared_ptr<StageBuffer>& output, const bool ordered);
+
+        /// FusedBuffer::add(): process() on the calling thread, counted as this stage taking the data.
+        BufferResult processFused(const shared_ptr<StageData>& data);
+
+        BufferResult refusedByBudget() const { return m_budget->closed() ? BufferResult::Closed : BufferResult::Rejected; }
+
+        /// Data passed on by an ordered stage belongs to the input being worked on, unless it's one of the inputs
+        /// taken since the stage last asked for data, i.e. passed on as it was taken.
+        void sequenceOutput(StageData& data) const
+        {
+            if (std::find(m_inputSequences.begin(), m_inputSequences.end(), data.sequence()) == m_inputSequences.end())
+                data.sequence(m_inputSequences.empty() ? 0U : m_inputSequences.back());
+        }
+
+        void completeSequences();
+
+        /// Nothing feeds this stage, neither another stage nor injectData(), so what it passes on is entering the pipeline.
+        bool isSource() const { return !m_data->hasProducers.load(std::memory_order_relaxed); }
+
+        /// Data a stage creates entered the pipeline with the input it was created from, unless the stage has no inputs.
+        Clock::time_point injectTimeOfOutput(const Clock::time_point& now) const
+        {
+            return (!isSource() && m_inputInjectTime != Clock::time_point{}) ? m_inputInjectTime : now;
+        }
+
+        BufferResult forward(const shared_ptr<StageData>& data);
+        BufferResult forwardBatch(const std::vector<shared_ptr<StageData>>& batch);
+
+
+    private:
+        string m_name;
+        StageId m_id;
+        std::atomic_bool m_stopRequest;
+        shared_ptr<StageBuffer> m_data;
+        std::vector<shared_ptr<StageBuffer>> m_outputs;     ///< next stages' buffers, set by connect()
+        Router m_router;
+        std::vector<shared_ptr<StageData>> m_batchIn;   ///< only used by this stage's run() thread
+        std::vector<shared_ptr<StageData>> m_batchOut;
+        std::vector<std::vector<shared_ptr<StageData>>> m_batchRouted;
+        shared_ptr<MemoryBudget> m_budget;      ///< of the stage's pipeline, if it has one
+        bool m_sequenced;                       ///< input is a SequenceBuffer, so outputs are ordered
+        std::vector<uint64_t> m_inputSequences; ///< taken and not yet complete, only used by the stage's thread
+        Clock::time_point m_inputInjectTime;    ///< of the data last taken
+        shared_ptr<Executor> m_parallelExecutor;    ///< the pipeline's, for parallelFor()
+
+        std::atomic_uint64_t m_itemsIn;
+        std::atomic_uint64_t m_itemsOut;
+        std::atomic_uint64_t m_waitNs;
+        std::atomic_uint64_t m_busyNs;
+        std::atomic_uint64_t m_forwardNs;
+        std::atomic_size_t m_peakDepth;
+        Clock::time_point m_lastTake;               ///< when nextData()/nextBatch() last returned
+        std::chrono::nanoseconds m_idleSinceTake;        ///< forwarding or suspended since the last take, so not busy
+        LatencyHistogram m_dwell;
+        LatencyHistogram m_endToEnd;
+        shared_ptr<Poco::NotificationCenter> m_nc;
+
+        mutable std::mutex m_muxPause;
+        std::condition_variable m_cvPause;
+        std::atomic<PauseState> m_pauseState;
+    };
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "SpillSegment.hpp"
+
+#include <cstring>
+
+#include <Poco/TemporaryFile.h>
+#include <Poco/Exception.h>
+
+#include "Logger.hpp"
+
+
+namespace framework
+{
+    SpillSegment::SpillSegment(const std::string& directory, const size_t size) : m_file(Poco::TemporaryFile::tempName(directory)), m_writeOffset(0), m_readOffset(0)
+    {
+        m_file.createFile();
+
+        try
+        {
+            m_file.setSize(size);
+            m_memory = Poco::SharedMemory(m_file, Poco::SharedMemory::AM_WRITE);
+        }
+        catch (...)
+        {
+            m_file.remove();
+            throw;
+        }
+    }
+
+
+    SpillSegment::~SpillSegment()
+    {
+        // unmap before removing, Windows can't delete a mapped file
+        m_memory = Poco::SharedMemory();
+
+        try
+        {
+            m_file.remove();
+        }
+        catch (const Poco::Exception& ex)
+        {
+            logg("SpillSegment: failed to remove " + m_file.path() + ": " + ex.displayText());
+        }
+    }
+
+
+    bool SpillSegment::append(const char* bytes, const size_t size)
+    {
+        if (recordSize(size) > capacity() - m_writeOffset)
+            return false;
+
+        const uint64_t length = size;
+
+        // records aren't aligned, so copy rather than cast
+        std::memcpy(m_memory.begin() + m_writeOffset, &length, sizeof(length));
+        std::memcpy(m_memory.begin() + m_writeOffset + sizeof(length), bytes, size);
+
+        m_writeOffset += recordSize(size);
+
+        return true;
+    }
+
+
+    bool SpillSegment::read(std::vector<char>& out)
+    {
+        if (drained())
+            return false;
+
+        uint64_t length = 0;
+
+        if (sizeof(length) > m_writeOffset - m_readOffset)
+            return false;
+
+        std::memcpy(&length, m_memory.begin() + m_readOffset, sizeof(length));
+
+        // a length running past what was written means the file was changed under us
+        if (length > m_writeOffset - m_readOffset - sizeof(length))
+            return false;
+
+        const char* bytes = m_memory.begin() + m_readOffset + sizeof(length);
+        out.assign(bytes, bytes + length);
+
+        m_readOffset += recordSize(static_cast<size_t>(length));
+
+        return true;
+    }
+
+
+    void SpillSegment::reset()
+    {
+        m_writeOffset = 0;
+        m_readOffset = 0;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <Poco/File.h>
+#include <Poco/SharedMemory.h>
+
+
+namespace framework
+{
+    /// An append-only file mapped into memory, holding length prefixed records in the order they were appended.
+    /// Used by PipelineStage::BufferType::Spill to hold data which doesn't fit in memory: the pages are file backed,
+    /// so the OS can write them out rather than keep them in RAM. 
+    ///
+    /// Not thread safe. The file is deleted when the segment is destroyed.
+    class SpillSegment
+    {
+    public:
+        /// Creates and maps a file of size bytes in directory, the system's temp directory if empty.
+        /// Throws Poco::Exception if the file can't be created or mapped.
+        SpillSegment(const std::string& directory, const size_t size);
+        ~SpillSegment();
+
+        /// Returns false if the record doesn't fit in the space left.
+        bool append(const char* bytes, const size_t size);
+
+        /// Replaces out with the next record. Returns false if every record has been read, or the next record is 
+        /// corrupt, in which case the segment isn't drained().
+        bool read(std::vector<char>& out);
+
+        bool drained() const { return m_readOffset == m_writeOffset; }
+
+        /// Empties the segment so the file can be reused.
+        void reset();
+
+        size_t capacity() const { return static_cast<size_t>(m_memory.end() - m_memory.begin()); }
+
+        /// Space a record of size bytes takes.
+        static size_t recordSize(const size_t size) { return sizeof(uint64_t) + size; }
+
+    private:
+        SpillSegment(const SpillSegment&) = delete;
+        SpillSegment& operator=(const SpillSegment&) = delete;
+
+    private:
+        Poco::File m_file;
+        Poco::SharedMemory m_memory;
+        size_t m_writeOffset;
+        size_t m_readOffset;
+    };
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <type_traits>
+
+#include "PipelineStage.hpp"
+
+
+namespace framework
+{
+    using std::shared_ptr;
+    using std::unique_ptr;
+
+
+    /// A pool of StageData objects, for data which is expensive to create.
+    ///
+    /// acquire() returns a shared_ptr which, when the last reference is released (usually by the final stage),
+    /// returns the object to the pool rather than destroying it. The shared_ptr control blocks are pooled too,
+    /// so once the pool is warm, acquire() doesn't allocate.
+    ///
+    /// Objects are reset before being returned to the pool: StageData::resetStageData() and then the
+    /// optional reset function, i.e. to clear user data, but any buffers the object owns are kept.
+    ///
+    /// The pool can be destroyed while objects are in use: they are deleted when released.
+    ///
+    /// Usage:
+    ///    StageDataPool<Data> pool(8);     // pre-create 8 Data
+    ///     .......
+    ///    dataComplete(pool.acquire());
+    template<class DataT>
+    class StageDataPool
+    {
+        static_assert(std::is_base_of_v<StageData, DataT>, "StageDataPool type must derive from StageData");
+
+    public:
+        using Factory = std::function<unique_ptr<DataT>()>;
+        using Reset = std::function<void(DataT&)>;
+
+        struct Stats
+        {
+            uint64_t hits;          ///< acquire() reused a pooled object
+            uint64_t misses;        ///< acquire() had to create an object
+            uint64_t discarded;     ///< released when the pool was full, so deleted
+            size_t available;
+        };
+
+
+        /// initialSize objects are created now. At most maxSize released objects are kept, the rest are deleted.
+        /// Without a factory, DataT must be default constructible.
+        StageDataPool(const size_t initialSize = 0, const size_t maxSize = 1024U, Factory factory = nullptr, Reset reset = nullptr)
+            : m_state(std::make_shared<State>(maxSize, std::move(factory), std::move(reset)))
+        {
+            std::vector<shared_ptr<DataT>> initial;
+
+            for (size_t i = 0; i < initialSize; ++i)
+            {
+                initial.push_back(acquire());
+            }
+
+            // released here, filling the pool. Don't count as misses, these aren't from steady state
+            m_state->misses.store(0);
+        }
+
+
+        shared_ptr<DataT> acquire()
+        {
+            DataT* data = m_state->take();
+
+            if (data)
+            {
+                ++m_state->hits;
+            }
+            else
+            {
+                data = m_state->create().release();
+                ++m_state->misses;
+            }
+
+            return shared_ptr<DataT>(data, Recycler{ m_state }, ControlBlockAllocator<DataT>{ m_state });
+        }
+
+
+        Stats stats() const
+        {
+            return Stats{ m_state->hits.load(), m_state->misses.load(), m_state->discarded.load(), m_state->available() };
+        }
+
+
+        uint64_t hits() const { return m_state->hits.load(); }
+        uint64_t misses() const { return m_state->misses.load(); }
+        size_t available() const { return m_state->available(); }
+
+
+    private:
+        StageDataPool(const StageDataPool&) = delete;
+        StageDataPool& operator=(const StageDataPool&) = delete;
+
+
+        /// Shared by the pool and every object it hands out.
+        struct State
+        {
+            State(const size_t max, Factory&& f, Reset&& r) : maxSize(max), factory(std::move(f)), reset(std::move(r)),
+                                                              hits(0), misses(0), discarded(0), blockSize(0)
+            {
+
+            }
+
+            ~State()
+            {
+                for (auto data : pool)
+                    delete data;
+
+                for (auto block : blocks)
+                    ::operator delete(block);
+            }
+
+
+            unique_ptr<DataT> create()
+            {
+                if (factory)
+                    return factory();
+
+                if constexpr (std::is_default_constructible_v<DataT>)
+                    return std::make_unique<DataT>();
+                else
+                    throw std::runtime_error("StageDataPool requires a factory for types which aren't default constructible");
+            }
+
+
+            DataT* take()
+            {
+                std::scoped_lock lock(mux);
+
+                if (pool.empty())
+                    return nullptr;
+
+                DataT* data = pool.back();
+                pool.pop_back();
+                return data;
+            }
+
+
+            void recycle(DataT* data)
+            {
+                data->resetStageData();
+
+                if (reset)
+                    reset(*data);
+
+                {
+                    std::scoped_lock lock(mux);
+
+                    if (pool.size() < maxSize)
+                    {
+                        pool.push_back(data);
+                        return;
+                    }
+                }
+
+                ++discarded;
+                delete data;
+            }
+
+
+            size_t available() const
+            {
+                std::scoped_lock lock(mux);
+                return pool.size();
+            }
+
+
+            void* allocateBlock(const size_t size)
+            {
+                {
+                    std::scoped_lock lock(mux);
+
+                    if (blockSize == 0)
+                        blockSize = size;
+
+                    if (size == blockSize && !blocks.empty())
+                    {
+                        void* block = blocks.back();
+                        blocks.pop_back();
+                        return block;
+                    }
+                }
+
+                return ::operator new(size);
+            }
+
+
+            void deallocateBlock(void* block, const size_t size)
+            {
+                {
+                    std::scoped_lock lock(mux);
+
+                    if (size == blockSize && blocks.size() < maxSize)
+                    {
+                        blocks.push_back(block);
+                        return;
+                    }
+                }
+
+                ::operator delete(block);
+            }
+
+
+            const size_t maxSize;
+            Factory factory;
+            Reset reset;
+            std::atomic_uint64_t hits;
+            std::atomic_uint64_t misses;
+            std::atomic_uint64_t discarded;
+
+            mutable std::mutex mux;
+            std::vector<DataT*> pool;
+            std::vector<void*> blocks;  ///< shared_ptr control blocks
+            size_t blockSize;
+        };
+
+
+        /// shared_ptr deleter, returns the object to the pool.
+        struct Recycler
+        {
+            void operator()(DataT* data) const
+            {
+                state->recycle(data);
+            }
+
+            shared_ptr<State> state;
+        };
+
+
+        /// Allocates shared_ptr control blocks from the pool.
+        template<class T>
+        struct ControlBlockAllocator
+        {
+            using value_type = T;
+
+            ControlBlockAllocator(const shared_ptr<State>& s) : state(s)
+            {
+
+            }
+
+            template<class U>
+            ControlBlockAllocator(const ControlBlockAllocator<U>& other) : state(other.state)
+            {
+
+            }
+
+            T* allocate(const size_t n)
+            {
+                return static_cast<T*>(state->allocateBlock(n * sizeof(T)));
+            }
+
+            void deallocate(T* p, const size_t n)
+            {
+                state->deallocateBlock(p, n * sizeof(T));
+            }
+
+            template<class U>
+            bool operator==(const ControlBlockAllocator<U>& other) const { return state == other.state; }
+
+            template<class U>
+            bool operator!=(const ControlBlockAllocator<U>& other) const { return state != other.state; }
+
+            shared_ptr<State> state;
+        };
+
+
+    private:
+        shared_ptr<State> m_state;
+    };
+}
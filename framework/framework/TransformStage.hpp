@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PipelineStage.hpp"
+
+
+namespace framework
+{
+    /// A stage written as a function of one item, process(), rather than a run() loop. On its own it runs like any
+    /// stage, taking items from its buffer on a thread of its own. Fused with the stage before it (Pipeline::fuse())
+    /// it has no thread or queue: the previous stage's dataComplete() calls process() directly, so a chain of 
+    /// cheap transforms costs a function call per hop rather than a queue push and a wakeup.
+    ///
+    ///     class Scale : public TransformStage
+    ///     {
+    ///         virtual void process(shared_ptr<StageData>&& data) override
+    ///         {
+    ///             if (auto sample = std::dynamic_pointer_cast<Sample>(data); sample)
+    ///             {
+    ///                 sample->value *= m_factor;
+    ///                 dataComplete(std::move(data));
+    ///             }
+    ///         }
+    ///     };
+    ///
+    /// When fused, process() runs on the previous stage's thread, so it should be quick and must not call nextData().
+    class TransformStage : public PipelineStage
+    {
+    public:
+        virtual bool fusable() const override { return true; }
+
+        virtual void run() override
+        {
+            while (!shouldStop())
+            {
+                if (auto data = nextData(); data)
+                    process(std::move(data));
+            }
+        }
+
+    protected:
+        TransformStage(const string& name, const BufferConfig& bufferConfig = BufferConfig{}) : PipelineStage(name, bufferConfig)
+        {
+
+        }
+
+        virtual void process(shared_ptr<StageData>&& data) override = 0;
+    };
+}
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <tuple>
+#include <optional>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "ctpl_threadpool.hpp"
+
+
+namespace framework
+{
+    using namespace std::chrono_literals;
+
+
+    namespace detail
+    {
+        template<class T>
+        struct IsOptional : std::false_type {};
+
+        template<class T>
+        struct IsOptional<std::optional<T>> : std::true_type {};
+
+
+        /// Bounded, lock free single producer/single consumer queue of values,
+        /// see PipelineStage::RingBuffer for the StageData equivalent.
+        template<class T>
+        class SpscRing
+        {
+            static const size_t CacheLineSize = 64U;
+
+        public:
+            SpscRing(const size_t capacity) : m_slots(roundUpPowerOfTwo(capacity)), m_mask(m_slots.size() - 1U),
+                                              m_head(0), m_cachedTail(0), m_tail(0), m_cachedHead(0), m_consumerWaiting(false), m_producerWaiting(false)
+            {
+
+            }
+
+
+            /// Waits while full, returns false if stop is set before there's space.
+            bool push(T&& value, const std::atomic_bool& stop)
+            {
+                const size_t t = m_tail.load(std::memory_order_relaxed);
+
+                while (t - m_cachedHead >= m_slots.size())
+                {
+                    m_cachedHead = m_head.load(std::memory_order_acquire);
+
+                    if (t - m_cachedHead >= m_slots.size())
+                    {
+                        if (stop.load())
+                            return false;
+
+                        // park as the consumer does, checking stop every 100ms
+                        std::unique_lock lock(m_spaceMux);
+
+                        m_producerWaiting.store(true, std::memory_order_seq_cst);
+                        m_spaceCV.wait_for(lock, 100ms, [this, t, &stop] { return t - m_head.load(std::memory_order_seq_cst) < m_slots.size() || stop.load(); });
+                        m_producerWaiting.store(false, std::memory_order_relaxed);
+                    }
+                }
+
+                m_slots[t & m_mask].emplace(std::move(value));
+                m_tail.store(t + 1U, std::memory_order_seq_cst);
+
+                if (m_consumerWaiting.load(std::memory_order_seq_cst))
+                {
+                    std::scoped_lock lock(m_cvMux);
+                    m_cv.notify_one();
+                }
+
+                return true;
+            }
+
+
+            /// Waits up to waitMs for a value.
+            std::optional<T> pop(const std::chrono::milliseconds& waitMs)
+            {
+                const size_t h = m_head.load(std::memory_order_relaxed);
+
+                if (m_cachedTail == h)
+                {
+                    m_cachedTail = m_tail.load(std::memory_order_acquire);
+
+                    if (m_cachedTail == h)
+                    {
+                        std::unique_lock lock(m_cvMux);
+
+                        m_consumerWaiting.store(true, std::memory_order_seq_cst);
+                        m_cv.wait_for(lock, waitMs, [this, h] { return m_tail.load(std::memory_order_seq_cst) != h; });
+                        m_consumerWaiting.store(false, std::memory_order_relaxed);
+
+                        m_cachedTail = m_tail.load(std::memory_order_acquire);
+
+                        if (m_cachedTail == h)
+                            return std::nullopt;
+                    }
+                }
+
+                auto& slot = m_slots[h & m_mask];
+                std::optional<T> value(std::move(slot));
+                slot.reset();
+
+                m_head.store(h + 1U, std::memory_order_seq_cst);
+
+                if (m_producerWaiting.load(std::memory_order_seq_cst))
+                {
+                    std::scoped_lock lock(m_spaceMux);
+                    m_spaceCV.notify_one();
+                }
+
+                return value;
+            }
+
+
+            size_t size() const
+            {
+                const size_t h = m_head.load(std::memory_order_acquire);
+                return m_tail.load(std::memory_order_acquire) - h;
+            }
+
+
+        private:
+            static size_t roundUpPowerOfTwo(const size_t n)
+            {
+                size_t p = 2U;
+                while (p < n)
+                    p <<= 1U;
+                return p;
+            }
+
+
+        private:
+            std::vector<std::optional<T>> m_slots;
+            const size_t m_mask;
+
+            alignas(CacheLineSize) std::atomic_size_t m_head;
+            size_t m_cachedTail;
+
+            alignas(CacheLineSize) std::atomic_size_t m_tail;
+            size_t m_cachedHead;
+
+            alignas(CacheLineSize) std::atomic_bool m_consumerWaiting;
+            std::mutex m_cvMux;
+            std::condition_variable m_cv;
+
+            alignas(CacheLineSize) std::atomic_bool m_producerWaiting;
+            std::mutex m_spaceMux;
+            std::condition_variable m_spaceCV;
+        };
+
+
+        struct NoOutput {};
+    }
+
+
+    /// A pipeline where the stages and the data types passed between them are known at compile time.
+    ///
+    /// Each stage is a class which declares its InputType and OutputType and has a process() function which is called
+    /// for each item, on the stage's own thread:
+    ///
+    ///     struct Decode
+    ///     {
+    ///         using InputType = Packet;
+    ///         using OutputType = std::unique_ptr<Frame>;
+    ///
+    ///         std::optional<OutputType> process(Packet&& packet);     // or OutputType process(Packet&&), return nullopt to drop
+    ///     };
+    ///
+    /// A stage's OutputType must be the next stage's InputType, checked at compile time. The last stage's OutputType
+    /// can be void, otherwise its output is read with nextOutput().
+    ///
+    /// Data is moved between stages through lock free SPSC queues, so unlike Pipeline there's no virtual call,
+    /// shared_ptr or dynamic_pointer_cast per item. Use Pipeline when the stages aren't known at compile time.
+    ///
+    /// Usage:
+    ///     TypedPipeline<Parse, Decode, Render> pipeline;
+    ///     pipeline.start();
+    ///     pipeline.injectData(Packet{...});
+    template<class... Stages>
+    class TypedPipeline
+    {
+        static_assert(sizeof...(Stages) > 0, "TypedPipeline requires at least one stage");
+
+        static const size_t NumStages = sizeof...(Stages);
+
+        template<size_t I>
+        using StageAt = std::tuple_element_t<I, std::tuple<Stages...>>;
+
+        template<size_t... I>
+        static constexpr bool stageTypesMatch(std::index_sequence<I...>)
+        {
+            return (std::is_same_v<typename StageAt<I>::OutputType, typename StageAt<I + 1U>::InputType> && ...);
+        }
+
+        static_assert(stageTypesMatch(std::make_index_sequence<NumStages - 1U>{}), "A stage's OutputType must be the next stage's InputType");
+
+
+    public:
+        using InputType = typename StageAt<0>::InputType;
+        using OutputType = typename StageAt<NumStages - 1U>::OutputType;
+
+        static const size_t DefaultQueueCapacity = 1024U;
+
+
+        template<class... Args>
+        explicit TypedPipeline(const size_t queueCapacity = DefaultQueueCapacity, Args&&... stageArgs)
+            :   m_stages(std::forward<Args>(stageArgs)...),
+                m_queues(makeQueues(queueCapacity, std::make_index_sequence<NumStages>{})),
+                m_output(makeOutput(queueCapacity)),
+                m_stop(false)
+        {
+
+        }
+
+
+        ~TypedPipeline()
+        {
+            stop();
+        }
+
+
+        /// Does nothing if already started, call stop() first.
+        void start()
+        {
+            // a new pool would replace the running one, whose stages never see m_stop
+            if (m_pool)
+                return;
+
+            m_stop.store(false);
+            m_pool = std::make_unique<ctpl::thread_pool>(static_cast<int>(NumStages));
+
+            startStages(std::make_index_sequence<NumStages>{});
+        }
+
+
+        void stop()
+        {
+            m_stop.store(true);
+
+            if (m_pool)
+            {
+                m_pool->stop(true);
+                m_pool.reset();
+            }
+        }
+
+
+        /// Adds data to the first stage, waiting while its queue is full. Only call from one thread.
+        bool injectData(InputType&& data)
+        {
+            return std::get<0>(m_queues).push(std::move(data), m_stop);
+        }
+
+
+        /// Takes the last stage's output, if it has an OutputType. Only call from one thread.
+        template<class T = OutputType, class = std::enable_if_t<!std::is_void_v<T>>>
+        bool nextOutput(T& data, const std::chrono::milliseconds& waitMs = 100ms)
+        {
+            if (auto output = m_output.pop(waitMs); output)
+            {
+                data = std::move(*output);
+                return true;
+            }
+
+            return false;
+        }
+
+
+        template<size_t I>
+        StageAt<I>& stage() { return std::get<I>(m_stages); }
+
+        template<size_t I>
+        size_t queueSize() const { return std::get<I>(m_queues).size(); }
+
+
+    private:
+        TypedPipeline(const TypedPipeline&) = delete;
+        TypedPipeline& operator=(const TypedPipeline&) = delete;
+
+
+        using Queues = std::tuple<detail::SpscRing<typename Stages::InputType>...>;
+        using Output = std::conditional_t<std::is_void_v<OutputType>, detail::NoOutput, detail::SpscRing<std::conditional_t<std::is_void_v<OutputType>, int, OutputType>>>;
+
+
+        template<size_t... I>
+        static Queues makeQueues(const size_t capacity, std::index_sequence<I...>)
+        {
+            return Queues{ (static_cast<void>(I), capacity)... };
+        }
+
+
+        static Output makeOutput(const size_t capacity)
+        {
+            if constexpr (std::is_void_v<OutputType>)
+                return Output{};
+            else
+                return Output{ capacity };
+        }
+
+
+        template<size_t... I>
+        void startStages(std::index_sequence<I...>)
+        {
+            (m_pool->push([this](int) { runStage<I>(); }), ...);
+        }
+
+
+        template<size_t I>
+        void runStage()
+        {
+            using Stage = StageAt<I>;
+            using In = typename Stage::InputType;
+            using Out = typename Stage::OutputType;
+            using Result = decltype(std::declval<Stage&>().process(std::declval<In&&>()));
+
+            auto& stage = std::get<I>(m_stages);
+            auto& in = std::get<I>(m_queues);
+
+            while (!m_stop.load())
+            {
+                auto data = in.pop(100ms);
+
+                if (!data)
+                    continue;
+
+                if constexpr (std::is_void_v<Out>)
+                {
+                    stage.process(std::move(*data));
+                }
+                else if constexpr (detail::IsOptional<Result>::value)
+                {
+                    if (auto out = stage.process(std::move(*data)); out)
+                        forward<I>(std::move(*out));
+                }
+                else
+                {
+                    forward<I>(stage.process(std::move(*data)));
+                }
+            }
+        }
+
+
+        template<size_t I, class Out>
+        void forward(Out&& out)
+        {
+            if constexpr (I + 1U < NumStages)
+                std::get<I + 1U>(m_queues).push(std::forward<Out>(out), m_stop);
+            else
+                m_output.push(std::forward<Out>(out), m_stop);
+        }
+
+
+    private:
+        std::tuple<Stages...> m_stages;
+        Queues m_queues;
+        Output m_output;
+        std::atomic_bool m_stop;
+        std::unique_ptr<ctpl::thread_pool> m_pool;
+    };
+}
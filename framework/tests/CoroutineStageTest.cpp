@@ -0,0 +1,210 @@
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <atomic>
+
+#include <framework/Pipeline.hpp>
+#include <framework/CoroutineStage.hpp>
+
+#include "TestCheck.hpp"
+
+
+/// A CoroutineStage forwarding to a full, bounded buffer must be suspended until there's space, rather than
+/// keep an executor worker busy, also when several CoroutineStages wait on the same buffer. Replicated 
+/// CoroutineStages are refused.
+
+
+using namespace framework;
+using namespace std::chrono_literals;
+
+
+#ifdef FRAMEWORK_COROUTINES
+
+static const int Items = 200;
+
+
+struct Item : public StageData
+{
+    explicit Item(const int v) : value(v) {}
+
+    int value;
+};
+
+
+class Relay : public CoroutineStage
+{
+public:
+    explicit Relay(const shared_ptr<Executor>& executor) : CoroutineStage("relay", BufferConfig{}, executor) {}
+
+    virtual StageTask runAsync() override
+    {
+        while (!shouldStop())
+        {
+            if (auto item = co_await nextData<Item>(); item)
+                co_await forward(std::move(item));
+        }
+    }
+};
+
+
+class SlowSink : public PipelineStage
+{
+public:
+    explicit SlowSink(const BufferType type) : PipelineStage("sink", BufferConfig{ type, 2U }) {}
+
+    virtual void run() override
+    {
+        while (!shouldStop())
+        {
+            if (auto item = nextData<Item>(20ms); item)
+            {
+                inOrder = inOrder && item->value == received;
+                ++received;
+                std::this_thread::sleep_for(2ms);
+            }
+        }
+    }
+
+    std::atomic_int received{ 0 };
+    std::atomic_bool inOrder{ true };
+};
+
+
+class StalledSink : public PipelineStage
+{
+public:
+    StalledSink() : PipelineStage("sink", BufferConfig{ BufferType::Queue, 2U }) {}
+
+    virtual void run() override
+    {
+        while (!shouldStop())
+        {
+            if (!open)
+            {
+                std::this_thread::sleep_for(1ms);
+                continue;
+            }
+
+            if (auto item = nextData<Item>(20ms); item)
+                ++received;
+        }
+    }
+
+    std::atomic_bool open{ false };
+    std::atomic_int received{ 0 };
+};
+
+
+static void testFanInToStalledBuffer()
+{
+    auto executor = std::make_shared<Executor>(1U);
+
+    Pipeline pipeline("coroutine fan in");
+    auto sink = std::make_shared<StalledSink>();
+
+    const StageId first = pipeline.addStage(std::make_shared<Relay>(executor));
+    const StageId second = pipeline.addStage(std::make_shared<Relay>(executor));
+    const StageId stalled = pipeline.addStage(sink);
+
+    CHECK(pipeline.connect(first, stalled));
+    CHECK(pipeline.connect(second, stalled));
+    CHECK(pipeline.initialise());
+
+    pipeline.start();
+
+    for (int i = 0; i < Items; ++i)
+        pipeline.injectData(std::make_shared<Item>(i), i % 2 ? second : first);
+
+    // both relays are waiting on the full buffer by now
+    std::this_thread::sleep_for(50ms);
+
+    const std::clock_t cpuStart = std::clock();
+    const auto wallStart = std::chrono::steady_clock::now();
+
+    std::this_thread::sleep_for(300ms);
+
+    const double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    sink->open = true;
+
+    for (int i = 0; i < 500 && sink->received < Items; ++i)
+        std::this_thread::sleep_for(10ms);
+
+    pipeline.stop();
+
+    CHECK(sink->received == Items);
+
+#ifndef _WIN32
+    CHECK(cpu / wall < 0.2);
+#endif
+}
+
+
+static void testForwardToFullBuffer(const PipelineStage::BufferType type)
+{
+    auto executor = std::make_shared<Executor>(1U);
+
+    Pipeline pipeline("coroutine forward");
+    auto sink = std::make_shared<SlowSink>(type);
+
+    const StageId relay = pipeline.addStage(std::make_shared<Relay>(executor));
+    pipeline.addStage(sink);
+
+    CHECK(pipeline.initialise());
+
+    pipeline.start();
+
+    const std::clock_t cpuStart = std::clock();
+    const auto wallStart = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < Items; ++i)
+        pipeline.injectData(std::make_shared<Item>(i), relay);
+
+    for (int i = 0; i < 500 && sink->received < Items; ++i)
+        std::this_thread::sleep_for(10ms);
+
+    const double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    pipeline.stop();
+
+    CHECK(sink->received == Items);
+    CHECK(sink->inOrder);
+
+#ifndef _WIN32
+    CHECK(cpu / wall < 0.5);
+#endif
+}
+
+
+static void testReplicasRefused()
+{
+    auto executor = std::make_shared<Executor>(1U);
+
+    Pipeline pipeline("coroutine replicas");
+    pipeline.addStage([executor] { return std::make_shared<Relay>(executor); }, 2U);
+
+    CHECK(!pipeline.initialise());
+}
+
+
+int main()
+{
+    testForwardToFullBuffer(PipelineStage::BufferType::Queue);
+    testForwardToFullBuffer(PipelineStage::BufferType::RingBuffer);
+    testFanInToStalledBuffer();
+    testReplicasRefused();
+
+    return test::result("coroutine_stage_test");
+}
+
+#else
+
+int main()
+{
+    std::cout << "coroutine_stage_test: skipped, requires C++20 coroutines" << std::endl;
+    return 0;
+}
+
+#endif
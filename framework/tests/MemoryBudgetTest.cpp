@@ -0,0 +1,113 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include <framework/Pipeline.hpp>
+
+#include "TestCheck.hpp"
+
+
+/// A stage which replaces each item with a new one, under a budget of two items: the new items are already in
+/// the pipeline, so they must be charged without waiting, or the stage would wait on bytes only it can release.
+
+
+using namespace framework;
+using namespace std::chrono_literals;
+
+
+static const size_t Items = 100U;
+static const size_t ItemBytes = 5U;
+
+
+struct Item : public StageData
+{
+    explicit Item(const size_t v) : value(v) {}
+
+    virtual size_t byteSize() const override { return ItemBytes; }
+
+    size_t value;
+};
+
+
+class Transform : public PipelineStage
+{
+public:
+    Transform() : PipelineStage("transform") {}
+
+    virtual void run() override
+    {
+        while (!shouldStop())
+        {
+            if (auto item = nextData<Item>(20ms); item)
+                dataComplete(std::make_shared<Item>(item->value + 1U));
+        }
+    }
+};
+
+
+class Sink : public PipelineStage
+{
+public:
+    Sink() : PipelineStage("sink") {}
+
+    virtual void run() override
+    {
+        while (!shouldStop())
+        {
+            if (auto item = nextData<Item>(20ms); item)
+            {
+                inOrder = inOrder && item->value == received + 1U;
+                ++received;
+                std::this_thread::sleep_for(1ms);
+            }
+        }
+    }
+
+    std::atomic_size_t received{ 0 };
+    std::atomic_bool inOrder{ true };
+};
+
+
+int main()
+{
+    Pipeline pipeline("budget");
+    auto sink = std::make_shared<Sink>();
+
+    const StageId transform = pipeline.addStage(std::make_shared<Transform>());
+    pipeline.addStage(sink);
+
+    pipeline.setMemoryBudget(2U * ItemBytes);
+
+    CHECK(pipeline.initialise());
+
+    pipeline.start();
+
+    // the injector waits for the budget, on its own thread so a stall fails the test rather than hanging it
+    std::atomic_size_t injected{ 0 };
+
+    std::thread injector([&]
+    {
+        for (size_t i = 0; i < Items; ++i)
+        {
+            if (pipeline.injectData(std::make_shared<Item>(i), transform) != BufferResult::Added)
+                break;
+
+            ++injected;
+        }
+    });
+
+    for (int i = 0; i < 500 && sink->received < Items; ++i)
+        std::this_thread::sleep_for(10ms);
+
+    CHECK(sink->received == Items);
+    CHECK(sink->inOrder);
+    CHECK(pipeline.bytesInFlight() == 0U);
+
+    // releases the injector if it's stalled
+    pipeline.stop();
+    injector.join();
+
+    CHECK(injected == Items);
+
+    return test::result("memory_budget_test");
+}
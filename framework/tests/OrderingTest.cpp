@@ -0,0 +1,134 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <random>
+
+#include <framework/Pipeline.hpp>
+
+#include "TestCheck.hpp"
+
+
+/// An ordered, replicated stage whose replicas don't pass on exactly the object they took: some inputs are 
+/// dropped, some replaced by two new objects. Data must still leave in input order, without stalling.
+
+
+using namespace framework;
+using namespace std::chrono_literals;
+
+
+static const size_t Items = 300U;
+
+
+struct Item : public StageData
+{
+    explicit Item(const size_t v) : value(v) {}
+
+    size_t value;
+};
+
+
+class Reshape : public PipelineStage
+{
+public:
+    Reshape() : PipelineStage("reshape") {}
+
+    virtual void run() override
+    {
+        std::minstd_rand random(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+        while (!shouldStop())
+        {
+            auto item = nextData<Item>(20ms);
+
+            if (!item)
+                continue;
+
+            // so replicas finish out of order
+            std::this_thread::sleep_for(std::chrono::microseconds(random() % 2000U));
+
+            if (item->value % 3U == 1U)
+            {
+                dataComplete(std::make_shared<Item>(item->value * 10U));
+                dataComplete(std::make_shared<Item>(item->value * 10U + 1U));
+            }
+            else if (item->value % 3U == 2U)
+            {
+                dataComplete(std::move(item));
+            }
+        }
+    }
+};
+
+
+class Sink : public PipelineStage
+{
+public:
+    Sink() : PipelineStage("sink") {}
+
+    virtual void run() override
+    {
+        while (!shouldStop())
+        {
+            if (auto item = nextData<Item>(20ms); item)
+            {
+                std::scoped_lock lock(mux);
+                values.push_back(item->value);
+            }
+        }
+    }
+
+    std::mutex mux;
+    std::vector<size_t> values;
+};
+
+
+int main()
+{
+    Pipeline pipeline("ordering");
+    auto sink = std::make_shared<Sink>();
+
+    const StageId reshape = pipeline.addStage([] { return std::make_shared<Reshape>(); }, 4U, true);
+    pipeline.addStage(sink);
+
+    CHECK(pipeline.initialise());
+
+    pipeline.start();
+
+    for (size_t i = 0; i < Items; ++i)
+        CHECK(pipeline.injectData(std::make_shared<Item>(i), reshape) == BufferResult::Added);
+
+    std::vector<size_t> expected;
+
+    for (size_t i = 0; i < Items; ++i)
+    {
+        if (i % 3U == 1U)
+        {
+            expected.push_back(i * 10U);
+            expected.push_back(i * 10U + 1U);
+        }
+        else if (i % 3U == 2U)
+        {
+            expected.push_back(i);
+        }
+    }
+
+    for (int i = 0; i < 500; ++i)
+    {
+        {
+            std::scoped_lock lock(sink->mux);
+
+            if (sink->values.size() >= expected.size())
+                break;
+        }
+
+        std::this_thread::sleep_for(10ms);
+    }
+
+    pipeline.stop();
+
+    CHECK(sink->values == expected);
+
+    return test::result("ordering_test");
+}
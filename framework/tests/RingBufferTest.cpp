@@ -0,0 +1,167 @@
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include <atomic>
+#include <vector>
+
+#include <framework/Pipeline.hpp>
+#include <framework/TypedPipeline.hpp>
+
+#include "TestCheck.hpp"
+
+
+/// OverflowPolicy::Block on a RingBuffer, and TypedPipeline's queues: a producer faster than its consumer 
+/// must wait without spinning, and nothing is lost or reordered.
+
+
+using namespace framework;
+using namespace std::chrono_literals;
+
+
+static const size_t Items = 200U;
+static const auto ConsumerDelay = 2ms;
+
+
+struct Item : public StageData
+{
+    explicit Item(const size_t v) : value(v) {}
+
+    size_t value;
+};
+
+
+class Producer : public PipelineStage
+{
+public:
+    Producer() : PipelineStage("producer") {}
+
+    virtual void run() override
+    {
+        for (size_t i = 0; i < Items && !shouldStop(); ++i)
+            dataComplete(std::make_shared<Item>(i));
+
+        while (!shouldStop())
+            std::this_thread::sleep_for(10ms);
+    }
+};
+
+
+class SlowConsumer : public PipelineStage
+{
+public:
+    SlowConsumer() : PipelineStage("consumer", BufferConfig{ BufferType::RingBuffer, 4U }) {}
+
+    virtual void run() override
+    {
+        while (!shouldStop())
+        {
+            if (auto item = nextData<Item>(20ms); item)
+            {
+                inOrder = inOrder && item->value == received;
+                ++received;
+                std::this_thread::sleep_for(ConsumerDelay);
+            }
+        }
+    }
+
+    std::atomic_size_t received{ 0 };
+    std::atomic_bool inOrder{ true };
+};
+
+
+struct SlowTypedStage
+{
+    using InputType = size_t;
+    using OutputType = void;
+
+    void process(size_t&& value)
+    {
+        inOrder = inOrder && value == received;
+        ++received;
+        std::this_thread::sleep_for(ConsumerDelay);
+    }
+
+    std::atomic_size_t received{ 0 };
+    std::atomic_bool inOrder{ true };
+};
+
+
+/// Process CPU time as a fraction of the wall time fn() takes. Only meaningful where clock() is CPU time.
+template<class Fn>
+static double cpuShare(Fn fn)
+{
+    const std::clock_t cpuStart = std::clock();
+    const auto wallStart = std::chrono::steady_clock::now();
+
+    fn();
+
+    const double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    return cpu / wall;
+}
+
+
+static void testRingBufferBlock()
+{
+    Pipeline pipeline("ring block");
+    auto consumer = std::make_shared<SlowConsumer>();
+
+    pipeline.addStage(std::make_shared<Producer>());
+    pipeline.addStage(consumer);
+
+    CHECK(pipeline.initialise());
+
+    const double share = cpuShare([&]
+    {
+        pipeline.start();
+
+        for (int i = 0; i < 500 && consumer->received < Items; ++i)
+            std::this_thread::sleep_for(10ms);
+    });
+
+    pipeline.stop();
+
+    CHECK(consumer->received == Items);
+    CHECK(consumer->inOrder);
+
+#ifndef _WIN32
+    // a spinning producer alone is a whole core
+    CHECK(share < 0.5);
+#endif
+}
+
+
+static void testTypedPipelineBlock()
+{
+    TypedPipeline<SlowTypedStage> pipeline(4U);
+
+    pipeline.start();
+
+    const double share = cpuShare([&]
+    {
+        for (size_t i = 0; i < Items; ++i)
+            CHECK(pipeline.injectData(size_t(i)));
+    });
+
+    for (int i = 0; i < 100 && pipeline.stage<0>().received < Items; ++i)
+        std::this_thread::sleep_for(10ms);
+
+    pipeline.stop();
+
+    CHECK(pipeline.stage<0>().received == Items);
+    CHECK(pipeline.stage<0>().inOrder);
+
+#ifndef _WIN32
+    CHECK(share < 0.5);
+#endif
+}
+
+
+int main()
+{
+    testRingBufferBlock();
+    testTypedPipelineBlock();
+
+    return test::result("ring_buffer_test");
+}
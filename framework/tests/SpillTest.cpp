@@ -0,0 +1,209 @@
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <fstream>
+
+#include <Poco/File.h>
+#include <Poco/TemporaryFile.h>
+
+#include <framework/Pipeline.hpp>
+
+#include "TestCheck.hpp"
+
+
+/// A BufferType::Spill stage which is held back until most of its input is spilled, across several segments. 
+/// Everything must come back in order, drained segments be recycled and the files be deleted with the buffer.
+/// Spilled data that can't be read back, here because the files are overwritten, is dropped rather than left 
+/// counted in the buffer's depth.
+
+
+using namespace framework;
+using namespace std::chrono_literals;
+
+
+static const size_t Items = 100U;
+static const size_t MemoryItems = 4U;
+
+
+struct Item : public StageData
+{
+    explicit Item(const size_t v) : value(v) {}
+
+    size_t value;
+};
+
+
+class Sink : public PipelineStage
+{
+public:
+    explicit Sink(const BufferConfig& config) : PipelineStage("sink", config) {}
+
+    virtual void run() override
+    {
+        while (!shouldStop())
+        {
+            if (!open)
+            {
+                std::this_thread::sleep_for(1ms);
+                continue;
+            }
+
+            if (auto item = nextData<Item>(20ms); item)
+            {
+                std::scoped_lock lock(mux);
+                values.push_back(item->value);
+            }
+        }
+    }
+
+    size_t received()
+    {
+        std::scoped_lock lock(mux);
+        return values.size();
+    }
+
+    std::atomic_bool open{ false };
+    std::mutex mux;
+    std::vector<size_t> values;
+};
+
+
+static PipelineStage::BufferConfig spillConfig(const std::string& directory)
+{
+    PipelineStage::BufferConfig config(PipelineStage::BufferType::Spill, MemoryItems);
+
+    config.spill.directory = directory;
+    config.spill.segmentSize = 256U;    // a handful of items per segment
+    config.spill.spareSegments = 1U;
+    config.spill.serialize = [](const StageData& data, std::vector<char>& bytes)
+    {
+        const size_t value = static_cast<const Item&>(data).value;
+        bytes.insert(bytes.end(), reinterpret_cast<const char*>(&value), reinterpret_cast<const char*>(&value) + sizeof(value));
+    };
+    config.spill.deserialize = [](const char* bytes, const size_t size) -> shared_ptr<StageData>
+    {
+        size_t value = 0;
+
+        if (size != sizeof(value))
+            return nullptr;
+
+        std::memcpy(&value, bytes, sizeof(value));
+        return std::make_shared<Item>(value);
+    };
+
+    return config;
+}
+
+
+static std::vector<std::string> segmentFiles(const std::string& directory)
+{
+    std::vector<std::string> files;
+    Poco::File(directory).list(files);
+    return files;
+}
+
+
+static void waitForItems(Sink& sink, const size_t count)
+{
+    for (int i = 0; i < 500 && sink.received() < count; ++i)
+        std::this_thread::sleep_for(10ms);
+}
+
+
+static void roundTrip(const std::string& directory)
+{
+    {
+        Pipeline pipeline("spill");
+        auto sink = std::make_shared<Sink>(spillConfig(directory));
+
+        pipeline.addStage(sink);
+
+        CHECK(pipeline.initialise());
+
+        pipeline.start();
+
+        for (size_t i = 0; i < Items; ++i)
+            CHECK(pipeline.injectData(std::make_shared<Item>(i)) == BufferResult::Added);
+
+        CHECK(sink->queueSize() == Items);
+        CHECK(segmentFiles(directory).size() > 1U);
+
+        sink->open = true;
+        waitForItems(*sink, Items);
+
+        std::vector<size_t> expected(Items);
+
+        for (size_t i = 0; i < Items; ++i)
+            expected[i] = i;
+
+        {
+            std::scoped_lock lock(sink->mux);
+            CHECK(sink->values == expected);
+        }
+
+        // drained segments are deleted, except the spare
+        CHECK(sink->queueSize() == 0U);
+        CHECK(segmentFiles(directory).size() <= 1U);
+
+        pipeline.stop();
+    }
+
+    CHECK(segmentFiles(directory).empty());
+}
+
+
+static void unreadable(const std::string& directory)
+{
+    Pipeline pipeline("spill");
+    auto sink = std::make_shared<Sink>(spillConfig(directory));
+
+    pipeline.addStage(sink);
+
+    CHECK(pipeline.initialise());
+
+    pipeline.start();
+
+    for (size_t i = 0; i < Items; ++i)
+        CHECK(pipeline.injectData(std::make_shared<Item>(i)) == BufferResult::Added);
+
+    // every record length runs past the end of what was written
+    for (const auto& file : segmentFiles(directory))
+    {
+        std::fstream segment(directory + "/" + file, std::ios::in | std::ios::out | std::ios::binary);
+        const uint64_t length = UINT64_MAX;
+        segment.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    }
+
+    sink->open = true;
+    waitForItems(*sink, MemoryItems);
+    std::this_thread::sleep_for(100ms);
+
+    CHECK(sink->received() == MemoryItems);
+    CHECK(sink->queueSize() == 0U);
+
+    // nothing is left spilled, so new data is kept in memory and flows again
+    CHECK(pipeline.injectData(std::make_shared<Item>(Items)) == BufferResult::Added);
+    waitForItems(*sink, MemoryItems + 1U);
+
+    CHECK(sink->received() == MemoryItems + 1U);
+
+    pipeline.stop();
+}
+
+
+int main()
+{
+    const std::string directory = Poco::TemporaryFile::tempName();
+    Poco::File(directory).createDirectories();
+
+    roundTrip(directory);
+    unreadable(directory);
+
+    Poco::File(directory).remove(true);
+
+    return test::result("spill_test");
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <iostream>
+
+
+/// Minimal checks for the regression tests, so they don't need a test framework: each test is an executable
+/// which returns non zero, for ctest, if any CHECK failed.
+namespace framework::test
+{
+    inline int failures = 0;
+
+
+    inline int result(const char* name)
+    {
+        std::cout << name << (failures ? ": FAILED" : ": passed") << std::endl;
+        return failures ? 1 : 0;
+    }
+}
+
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            ++framework::test::failures; \
+        } \
+    } while (false)